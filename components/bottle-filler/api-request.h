@@ -0,0 +1,463 @@
+/*
+ * esp-bolle-filler
+ * Copyright (C) Jeroen Dekien 2024 <dekien@gmail.com>
+ *
+ */
+
+#ifndef _API_REQUEST_H_
+#define _API_REQUEST_H_
+
+#include <cstring>
+#include <string>
+
+#include "nlohmann_json.hpp"
+
+using namespace std;
+using json = nlohmann::json;
+
+// FNV-1a, constexpr so every command name in a switch is hashed by the compiler
+// two names with the same hash give a duplicate case label, so a collision can't go unnoticed
+constexpr uint32_t commandHash(const char *name, size_t length)
+{
+    uint32_t hash = 2166136261u;
+
+    for (size_t i = 0; i < length; i++)
+    {
+        hash ^= (uint8_t)name[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+constexpr uint32_t commandHash(const char *name)
+{
+    return commandHash(name, std::char_traits<char>::length(name));
+}
+
+// a command name with its hash, so the name can be checked once the hash picked the command
+struct ApiCommandName
+{
+    uint32_t Hash;
+    const char *Name;
+
+    constexpr ApiCommandName(const char *name) : Hash(commandHash(name)), Name(name) {};
+};
+
+// what a handler gets from {"command": "...", "data": ...}, scalars of data are picked out while parsing
+// Data is only built for commands that need the whole object, see NeedsData
+struct ApiRequest
+{
+    uint32_t CommandHash = 0;
+    char Command[32] = {}; // for logging, cut when longer
+
+    bool HasId = false;
+    uint32_t Id = 0;
+    bool HasTime = false;
+    uint32_t Time = 0;
+    bool HasHandle = false;
+    uint32_t Handle = 0;
+
+    json Data;
+};
+
+// the hash only narrows it down, another name with the same hash is not the command
+template <size_t Count>
+bool commandKnown(const ApiCommandName (&commands)[Count], const ApiRequest &request)
+{
+    for (const ApiCommandName &command : commands)
+    {
+        if (command.Hash == request.CommandHash)
+        {
+            return strcmp(command.Name, request.Command) == 0;
+        }
+    }
+
+    return false;
+}
+
+typedef bool (*NeedsDataFunction)(uint32_t hash);
+
+// SAX handler for an api request, no dom is built unless the command needs its data as json.
+// When data comes before the command it is always built, the command isn't known yet.
+class ApiRequestParser : public nlohmann::json_sax<json>
+{
+private:
+    enum RootKey
+    {
+        KeyOther = 0,
+        KeyCommand,
+        KeyData
+    };
+
+    enum DataKey
+    {
+        DataOther = 0,
+        DataId,
+        DataTime,
+        DataHandle
+    };
+
+    ApiRequest &request;
+    NeedsDataFunction needsData;
+    nlohmann::detail::json_sax_dom_parser<json> dom;
+
+    uint32_t depth = 0; // nesting outside of data, 1 is the root object
+    RootKey rootKey = KeyOther;
+    bool hasCommand = false;
+
+    bool inData = false;
+    bool buildData = false;
+    uint32_t dataDepth = 0;
+    DataKey dataKey = DataOther;
+
+    bool failed = false;
+
+    // a value at root level, data is entered here
+    bool enterValue()
+    {
+        if (this->depth == 0)
+        {
+            // the root must be an object
+            this->failed = true;
+            return false;
+        }
+
+        if (this->depth == 1 && this->rootKey == KeyData)
+        {
+            this->inData = true;
+            this->dataDepth = 0;
+            this->buildData = !this->hasCommand || this->needsData(this->request.CommandHash);
+        }
+
+        return true;
+    };
+
+    void captureScalar(uint64_t value)
+    {
+        if (this->dataDepth != 1)
+        {
+            return;
+        }
+
+        switch (this->dataKey)
+        {
+        case DataId:
+            this->request.HasId = true;
+            this->request.Id = (uint32_t)value;
+            break;
+        case DataTime:
+            this->request.HasTime = true;
+            this->request.Time = (uint32_t)value;
+            break;
+        case DataHandle:
+            this->request.HasHandle = true;
+            this->request.Handle = (uint32_t)value;
+            break;
+        default:
+            break;
+        }
+    };
+
+    // scalar inside data, or data itself being a scalar
+    void endDataScalar()
+    {
+        if (this->dataDepth == 0)
+        {
+            this->inData = false;
+        }
+    };
+
+public:
+    ApiRequestParser(ApiRequest &request, NeedsDataFunction needsData) : request(request), needsData(needsData), dom(request.Data, false) {};
+
+    // the request is usable, the command is known and the json was complete
+    bool Complete()
+    {
+        return !this->failed && this->hasCommand && this->depth == 0;
+    };
+
+    bool null() override
+    {
+        if (!this->inData && !this->enterValue())
+        {
+            return false;
+        }
+
+        if (!this->inData)
+        {
+            return true;
+        }
+
+        if (this->buildData)
+        {
+            this->dom.null();
+        }
+
+        this->endDataScalar();
+        return true;
+    };
+
+    bool boolean(bool val) override
+    {
+        if (!this->inData && !this->enterValue())
+        {
+            return false;
+        }
+
+        if (!this->inData)
+        {
+            return true;
+        }
+
+        if (this->buildData)
+        {
+            this->dom.boolean(val);
+        }
+
+        this->endDataScalar();
+        return true;
+    };
+
+    bool number_integer(number_integer_t val) override
+    {
+        if (!this->inData && !this->enterValue())
+        {
+            return false;
+        }
+
+        if (!this->inData)
+        {
+            return true;
+        }
+
+        if (val >= 0)
+        {
+            this->captureScalar((uint64_t)val);
+        }
+
+        if (this->buildData)
+        {
+            this->dom.number_integer(val);
+        }
+
+        this->endDataScalar();
+        return true;
+    };
+
+    bool number_unsigned(number_unsigned_t val) override
+    {
+        if (!this->inData && !this->enterValue())
+        {
+            return false;
+        }
+
+        if (!this->inData)
+        {
+            return true;
+        }
+
+        this->captureScalar(val);
+
+        if (this->buildData)
+        {
+            this->dom.number_unsigned(val);
+        }
+
+        this->endDataScalar();
+        return true;
+    };
+
+    bool number_float(number_float_t val, const string_t &s) override
+    {
+        if (!this->inData && !this->enterValue())
+        {
+            return false;
+        }
+
+        if (!this->inData)
+        {
+            return true;
+        }
+
+        if (this->buildData)
+        {
+            this->dom.number_float(val, s);
+        }
+
+        this->endDataScalar();
+        return true;
+    };
+
+    bool string(string_t &val) override
+    {
+        if (!this->inData && !this->enterValue())
+        {
+            return false;
+        }
+
+        if (!this->inData)
+        {
+            if (this->depth == 1 && this->rootKey == KeyCommand)
+            {
+                this->request.CommandHash = commandHash(val.c_str(), val.length());
+                strncpy(this->request.Command, val.c_str(), sizeof(this->request.Command) - 1);
+                this->hasCommand = true;
+            }
+
+            return true;
+        }
+
+        if (this->buildData)
+        {
+            this->dom.string(val);
+        }
+
+        this->endDataScalar();
+        return true;
+    };
+
+    bool binary(binary_t &val) override
+    {
+        // not in json text
+        this->failed = true;
+        return false;
+    };
+
+    bool start_object(std::size_t elements) override
+    {
+        if (!this->inData)
+        {
+            if (this->depth > 0 && !this->enterValue())
+            {
+                return false;
+            }
+
+            if (!this->inData)
+            {
+                this->depth++;
+                return true;
+            }
+        }
+
+        this->dataDepth++;
+
+        if (this->buildData)
+        {
+            this->dom.start_object(elements);
+        }
+
+        return true;
+    };
+
+    bool key(string_t &val) override
+    {
+        if (!this->inData)
+        {
+            if (this->depth == 1)
+            {
+                this->rootKey = val == "command" ? KeyCommand : val == "data" ? KeyData
+                                                                              : KeyOther;
+            }
+
+            return true;
+        }
+
+        if (this->dataDepth == 1)
+        {
+            this->dataKey = val == "id" ? DataId : val == "time" ? DataTime
+                                               : val == "handle" ? DataHandle
+                                                                 : DataOther;
+        }
+
+        if (this->buildData)
+        {
+            this->dom.key(val);
+        }
+
+        return true;
+    };
+
+    bool end_object() override
+    {
+        if (!this->inData)
+        {
+            this->depth--;
+            return true;
+        }
+
+        this->dataDepth--;
+
+        if (this->buildData)
+        {
+            this->dom.end_object();
+        }
+
+        if (this->dataDepth == 0)
+        {
+            this->inData = false;
+        }
+
+        return true;
+    };
+
+    bool start_array(std::size_t elements) override
+    {
+        if (!this->inData)
+        {
+            if (!this->enterValue())
+            {
+                return false;
+            }
+
+            if (!this->inData)
+            {
+                this->depth++;
+                return true;
+            }
+        }
+
+        this->dataDepth++;
+
+        // an array has no keys, its values must not be taken for the last key of the object around it
+        this->dataKey = DataOther;
+
+        if (this->buildData)
+        {
+            this->dom.start_array(elements);
+        }
+
+        return true;
+    };
+
+    bool end_array() override
+    {
+        if (!this->inData)
+        {
+            this->depth--;
+            return true;
+        }
+
+        this->dataDepth--;
+
+        if (this->buildData)
+        {
+            this->dom.end_array();
+        }
+
+        if (this->dataDepth == 0)
+        {
+            this->inData = false;
+        }
+
+        return true;
+    };
+
+    bool parse_error(std::size_t position, const std::string &last_token, const nlohmann::detail::exception &ex) override
+    {
+        this->failed = true;
+        return false;
+    };
+};
+
+#endif // _API_REQUEST_H_
@@ -9,6 +9,72 @@ using json = nlohmann::json;
 
 static const char *TAG = "BottleFiller";
 
+#if CONFIG_API_BENCHMARK
+// counts every c++ heap allocation, only in benchmark builds, other tasks allocating during a run are counted too
+static std::atomic<uint32_t> benchmarkAllocations = 0;
+
+void *operator new(size_t size)
+{
+	benchmarkAllocations++;
+
+	void *ptr = malloc(size);
+	if (ptr == nullptr)
+	{
+		throw std::bad_alloc();
+	}
+
+	return ptr;
+}
+
+void operator delete(void *ptr) noexcept
+{
+	free(ptr);
+}
+
+void operator delete(void *ptr, size_t size) noexcept
+{
+	free(ptr);
+}
+#endif
+
+// without fade stop (esp32) a new duty waits until a running fade ends, an abort during a ramp would not cut the pump
+// and would hold up the fill scheduler, so the ramps are only used where a fade can be stopped
+#if SOC_LEDC_SUPPORT_FADE_STOP
+static const bool pumpRampsEnabled = true;
+#else
+static const bool pumpRampsEnabled = false;
+#endif
+
+// flow and weight keep rising after the pump stops, measure the overshoot when it has settled
+static const int64_t overshootSettleTime = 2000000; // in us
+
+// learned values and counters change after every fill, limit the nvs writes
+static const int64_t statsFlushInterval = 60000000; // in us
+
+// a line that never stops filling still gets its counters written
+static const int64_t statsMaxFlushDelay = 300000000; // in us
+
+// the pump watchdog looks at every watched filler this often, a check is a few compares and a register read
+static const int64_t watchdogInterval = 100000; // in us
+
+// slack on top of the expected pump on time before the watchdog steps in
+static const int64_t watchdogMargin = 1000000; // in us
+
+// longer gaps between pump starts are a typo, a line with 8 heads would take minutes to start
+static const uint64_t maxStaggerTime = 10000; // in ms
+
+// status frames go out on every change but never faster than this, changes in between are merged
+static const uint32_t statusMinInterval = 250; // in ms
+
+// while a pump runs the elapsed and remaining times are refreshed this often
+static const uint32_t statusRefreshInterval = 1000; // in ms
+
+// more than the httpd server keeps open, so every websocket client fits
+static const size_t maxStatusClients = 16;
+
+// an idle event stream gets a comment this often, a client that went away is found by the failed send
+static const uint32_t eventKeepAliveInterval = 15000; // in ms
+
 // esp http server only works with static handlers, no other option atm then to save a pointer.
 BottleFiller *mainInstance;
 
@@ -21,14 +87,18 @@ BottleFiller::BottleFiller(SettingsManager *settingsManager)
 
 void BottleFiller::Init()
 {
+	this->buildDutyTable();
+
 	// read the post important settings first so when van set outputs asap.
 	this->readSystemSettings();
 
 	// get out fillers
 	this->readFillerSettings();
+	this->readOvershoot();
+	this->readCounters();
 
-	// init out fillers
-	this->initFillers();
+	// used by the inputs and the flow meters
+	ESP_ERROR_CHECK(gpio_install_isr_service(0));
 
 	// init gpio as soon as possible
 	if (this->invertOutputs)
@@ -39,20 +109,41 @@ void BottleFiller::Init()
 
 	uint16_t freq = 5000; // Frequency in Hertz. Set frequency at 5 kHz
 
-	// Prepare and then apply the LEDC PWM timer configuration
-	ledc_timer_config_t ledc_timer = {};
+	// Prepare and then apply the LEDC PWM timer configuration, a timer for every speed mode of the chip
+	// the allocator hands out no channel before this, so it has to come before the fillers
+	ESP_ERROR_CHECK(this->ledcAllocator.Init(freq, LEDC_TIMER_13_BIT));
 
-	ledc_timer.speed_mode = LEDC_LOW_SPEED_MODE;
-	ledc_timer.timer_num = LEDC_TIMER_0;
-	ledc_timer.duty_resolution = LEDC_TIMER_13_BIT;
-	ledc_timer.freq_hz = freq; // Set output frequency at 5 kHz
-	ledc_timer.clk_cfg = LEDC_AUTO_CLK;
-	ESP_ERROR_CHECK(ledc_timer_config(&ledc_timer));
+	// hardware fade for the soft start/stop ramps
+	ESP_ERROR_CHECK(ledc_fade_func_install(0));
+
+	// init out fillers
+	this->initFillers();
 
 	this->run = true;
 
+	// start the fill scheduler, all pump control goes through this task
+	this->fillQueue = xQueueCreate(16, sizeof(FillCommand));
+
+	esp_timer_create_args_t timerArgs = {};
+	timerArgs.callback = &this->schedulerTimerCallback;
+	timerArgs.arg = this;
+	timerArgs.dispatch_method = ESP_TIMER_TASK;
+	timerArgs.name = "fillScheduler";
+	ESP_ERROR_CHECK(esp_timer_create(&timerArgs, &this->schedulerTimer));
+
+	xTaskCreate(&this->fillScheduler, "fillScheduler_task", 6144, this, 15, NULL);
+
+	// samples the load cells for weight mode, sleeps when there are none
+	xTaskCreate(&this->scaleLoop, "scaleLoop_task", 3072, this, 12, &this->scaleTask);
+
 	this->server = this->startWebserver();
 
+	// pushes the status the fill scheduler publishes to the websocket clients
+	xTaskCreate(&this->statusPushLoop, "statusPush_task", 6144, this, 5, &this->statusTask);
+
+	// sends the server-sent events, each client has its own backlog
+	xTaskCreate(&this->eventPushLoop, "eventPush_task", 3072, this, 5, &this->eventTask);
+
 	// init our inputs, this also starts the interrupt task
 	this->initInputs();
 }
@@ -67,591 +158,3227 @@ void BottleFiller::readSystemSettings()
 	configInvertOutputs = true;
 #endif
 	this->invertOutputs = this->settingsManager->Read("invertOutputs", configInvertOutputs);
+	this->maxConcurrentPumps = this->settingsManager->Read("maxPumps", (uint8_t)0);
+	this->staggerTime = this->settingsManager->Read("staggerTime", (uint16_t)0);
 
 	ESP_LOGI(TAG, "Reading BottleFiller Settings Done");
 }
 
-void BottleFiller::saveSystemSettingsJson(json config)
+// returns false when a value is out of range, nothing is saved then
+bool BottleFiller::saveSystemSettingsJson(json config)
 {
 	ESP_LOGI(TAG, "Saving System Settings");
 
+	bool hasMaxPumps = !config["maxConcurrentPumps"].is_null() && config["maxConcurrentPumps"].is_number();
+	bool hasStaggerTime = !config["staggerTime"].is_null() && config["staggerTime"].is_number();
+
+	// checked before anything is written, the narrow types would wrap
+	if (hasMaxPumps && (!config["maxConcurrentPumps"].is_number_unsigned() || config["maxConcurrentPumps"].get<uint64_t>() > MAX_FILLERS))
+	{
+		ESP_LOGW(TAG, "Max concurrent pumps must be 0 to %d", MAX_FILLERS);
+		return false;
+	}
+
+	if (hasStaggerTime && (!config["staggerTime"].is_number_unsigned() || config["staggerTime"].get<uint64_t>() > maxStaggerTime))
+	{
+		ESP_LOGW(TAG, "Stagger time must be 0 to %llu ms", maxStaggerTime);
+		return false;
+	}
+
 	if (!config["invertOutputs"].is_null() && config["invertOutputs"].is_boolean())
 	{
 		this->settingsManager->Write("invertOutputs", (bool)config["invertOutputs"]);
 		this->invertOutputs = (bool)config["invertOutputs"];
 	}
 
+	if (hasMaxPumps)
+	{
+		this->maxConcurrentPumps = (uint8_t)config["maxConcurrentPumps"].get<uint64_t>();
+		this->settingsManager->Write("maxPumps", this->maxConcurrentPumps);
+	}
+
+	if (hasStaggerTime)
+	{
+		this->staggerTime = (uint16_t)config["staggerTime"].get<uint64_t>();
+		this->settingsManager->Write("staggerTime", this->staggerTime);
+	}
+
+	this->responseCache.Invalidate(CachedSystemSettings);
+
 	ESP_LOGI(TAG, "Saving System Settings Done");
+
+	return true;
 }
 
-void BottleFiller::startAutoFill(void *arg)
+// single long lived task that owns the state of all fillers, other tasks only post commands
+void BottleFiller::fillScheduler(void *arg)
 {
-	//  we use our maininstance, passing 2 items via struct to xTaskCreate seems unreliable atm
-	BottleFiller *instance = mainInstance;
-
-	FillerConfig *filler = (FillerConfig *)arg;
+	BottleFiller *instance = (BottleFiller *)arg;
 
-	uint8_t fillerId = filler->id;
+	FillCommand command;
 
-	if (fillerId < 1)
+	while (true)
 	{
-		ESP_LOGE(TAG, "Filler id is invalid! %d", fillerId);
-		vTaskDelete(NULL);
-		return;
-	}
-
-	ESP_LOGI(TAG, "startAutoFill %d", fillerId);
+		if (xQueueReceive(instance->fillQueue, &command, portMAX_DELAY) != pdTRUE)
+		{
+			continue;
+		}
 
-	uint32_t ticks = xTaskGetTickCount();
-	uint32_t stopAt = ticks + (filler->fillTime / 10);
+		if (command.Type != DeadlineWake)
+		{
+			instance->handleFillCommand(command);
+		}
 
-	ESP_LOGI(TAG, "ticks %lu stopAt: %lu", ticks, stopAt);
+		instance->handleDeadlines();
+		instance->applyPendingConfigs();
+		instance->startPending();
+		instance->armSchedulerTimer();
+		instance->publishStatus();
 
-	uint16_t fillSpeed = (instance->maxDuty / 100) * filler->autoFillSpeed;
+		// swapped out configs are freed here, this task holds no filler pointer between wakes
+		instance->fillers.Reclaim();
+	}
+}
 
-	ledc_set_duty(LEDC_LOW_SPEED_MODE, (ledc_channel_t)filler->channel, fillSpeed);
-	ledc_update_duty(LEDC_LOW_SPEED_MODE, (ledc_channel_t)filler->channel);
+// called from the esp_timer task when the earliest deadline has passed
+void BottleFiller::schedulerTimerCallback(void *arg)
+{
+	BottleFiller *instance = (BottleFiller *)arg;
 
-	while (filler->status == Filling)
-	{
-		ticks = xTaskGetTickCount();
+	FillCommand command = {};
+	command.Type = DeadlineWake;
+	command.QueuedAt = esp_timer_get_time();
 
-		ESP_LOGI(TAG, "ticks %lu stopAt: %lu", ticks, stopAt);
+	// when the queue is full the scheduler is awake anyway
+	xQueueSend(instance->fillQueue, &command, 0);
+}
 
-		if (ticks >= stopAt)
-		{
-			ledc_set_duty(LEDC_LOW_SPEED_MODE, (ledc_channel_t)filler->channel, 0);
-			ledc_update_duty(LEDC_LOW_SPEED_MODE, (ledc_channel_t)filler->channel);
+// isr context, called by the flow meter when the stage volume is reached
+bool BottleFiller::flowTargetReached(uint8_t fillerId, void *arg)
+{
+	BottleFiller *instance = (BottleFiller *)arg;
 
-			ESP_LOGI(TAG, "Fill Complete %d", fillerId);
-			break;
-		}
+	FillCommand command = {};
+	command.Type = FlowReached;
+	command.FillerId = fillerId;
+	command.QueuedAt = esp_timer_get_time();
 
-		vTaskDelay(pdMS_TO_TICKS(100));
-	}
+	BaseType_t higherPriorityTaskWoken = pdFALSE;
+	xQueueSendFromISR(instance->fillQueue, &command, &higherPriorityTaskWoken);
 
-	ESP_LOGI(TAG, "startAutoFill %d Done", fillerId);
+	return higherPriorityTaskWoken == pdTRUE;
+}
 
-	// reset status to idle
-	filler->status = Idle;
+void BottleFiller::postFillCommand(FillCommandType type, uint8_t fillerId)
+{
+	FillCommand command = {};
+	command.Type = type;
+	command.FillerId = fillerId;
+	command.QueuedAt = esp_timer_get_time();
 
-	vTaskDelete(NULL);
+	if (xQueueSend(this->fillQueue, &command, pdMS_TO_TICKS(100)) != pdTRUE)
+	{
+		ESP_LOGE(TAG, "Fill queue full, command %d for %d dropped", type, fillerId);
+	}
 }
 
-void BottleFiller::start(uint8_t fillerId)
+void BottleFiller::postGangFill(uint32_t fillerMask)
 {
-	ESP_LOGI(TAG, "Start ID:%d", fillerId);
+	FillCommand command = {};
+	command.Type = GangFill;
+	command.FillerMask = fillerMask;
+	command.QueuedAt = esp_timer_get_time();
+
+	if (xQueueSend(this->fillQueue, &command, pdMS_TO_TICKS(100)) != pdTRUE)
+	{
+		ESP_LOGE(TAG, "Fill queue full, gang fill %lx dropped", fillerMask);
+	}
+}
 
-	std::map<uint8_t, FillerConfig *>::iterator it;
-	it = this->fillers.find(fillerId);
+void BottleFiller::handleFillCommand(const FillCommand &command)
+{
+	if (command.Type == GangFill)
+	{
+		this->startGangFill(command);
+		return;
+	}
 
-	if (it == this->fillers.end())
+	if (command.Type == SwapConfig)
 	{
-		// doesn't exist anymore, just ignore
-		ESP_LOGW(TAG, "Filler doesn't exist anymore, just ignore %d", fillerId);
+		this->swapConfig(command.Config);
 		return;
 	}
 
-	FillerConfig *filler = it->second;
-	if (filler->status == Idle)
+	if (command.Type == ReloadConfig)
 	{
-		filler->status = Filling;
+		this->reloadFiller(command);
+		return;
+	}
 
-		string taskName = "autofill" + to_string(fillerId);
+	FillerConfig *filler = this->fillers.Get(command.FillerId);
 
-		// we pass our pointer of our fillerconfig
-		xTaskCreate(&this->startAutoFill, taskName.c_str(), 2048, filler, 5, NULL);
+	if (filler == nullptr)
+	{
+		// doesn't exist anymore, just ignore
+		ESP_LOGW(TAG, "Filler doesn't exist anymore, just ignore %d", command.FillerId);
+		return;
 	}
-	else
+
+	switch (command.Type)
 	{
-		ESP_LOGI(TAG, "Not idle %d", filler->status);
+	case StartFill:
+		if (filler->status == Idle && filler->batchComplete())
+		{
+			ESP_LOGI(TAG, "Batch of %d complete, reset it to continue", filler->id);
+		}
+		else if (filler->status == Idle && filler->bottleMissing())
+		{
+			ESP_LOGW(TAG, "No bottle at %d", filler->id);
+		}
+		else if (filler->status == Idle)
+		{
+			this->requestStart(filler, command);
+		}
+		else
+		{
+			ESP_LOGI(TAG, "Not idle %d", filler->status.load());
+
+			// stop at once, the pending deadline becomes stale
+			this->finishFill(filler, true);
+		}
+		break;
+	case PrimeFill:
+		if (filler->status == Idle)
+		{
+			this->requestStart(filler, command);
+		}
+		break;
+	case TopUpFill:
+		if (filler->status == Idle && !filler->bottleMissing())
+		{
+			this->requestStart(filler, command);
+		}
+		break;
+	case BottlePlaced:
+		this->handleBottlePlaced(filler);
+		break;
+	case BottleRemoved:
+		this->handleBottleRemoved(filler);
+		break;
+	case AbortFill:
+		// a web abort only stops the manual fill it started, not whatever runs now
+		if (command.Handle != 0 && (command.Handle != filler->fillHandle || filler->status != ManualFilling))
+		{
+			break;
+		}
+
+		this->finishFill(filler, true);
+		break;
+	case FlowReached:
+		this->handleFlowReached(filler);
+		break;
+	case WeightReached:
+		this->handleWeightReached(filler);
+		break;
+	case ResetBatch:
+		filler->counters.BatchCount = 0;
+		this->scheduleStatsFlush(esp_timer_get_time());
+		break;
+	case ResetCounters:
+		filler->counters = {};
+		this->scheduleStatsFlush(esp_timer_get_time());
+		break;
+	case ResetOvershoot:
+		for (uint8_t mode = 0; mode < 3; mode++)
+		{
+			filler->overshoot[mode].Reset();
+		}
+		this->scheduleStatsFlush(esp_timer_get_time());
+		break;
+	case StartManual:
+		if (filler->status != Idle)
+		{
+			filler->refusedHandle = command.Handle;
+			ESP_LOGW(TAG, "Filler must be idle %d", filler->id);
+			break;
+		}
+
+		filler->status = ManualFilling;
+		filler->generation++;
+		filler->startedAt = esp_timer_get_time();
+		filler->fillHandle = command.Handle;
+		filler->manualEndsAt = 0;
+		this->rampPumpDuty(filler, filler->manualDuty, filler->rampUpTime);
+		this->watchPump(filler, filler->startedAt);
 
-		// stop at once
-		ledc_set_duty(LEDC_LOW_SPEED_MODE, (ledc_channel_t)filler->channel, 0);
-		ledc_update_duty(LEDC_LOW_SPEED_MODE, (ledc_channel_t)filler->channel);
+		// a timed fill ends on a deadline like an auto fill, nobody has to wait for it
+		if (command.Time > 0)
+		{
+			filler->manualEndsAt = filler->startedAt + ((int64_t)command.Time * 1000);
+
+			FillDeadline deadline;
+			deadline.At = filler->manualEndsAt;
+			deadline.Type = ManualEnd;
+			deadline.FillerId = filler->id;
+			deadline.Generation = filler->generation;
+			this->deadlines.push(deadline);
+		}
+		break;
+	case StopManual:
+		if (filler->status != ManualFilling)
+		{
+			break;
+		}
 
-		filler->status = Aborting;
+		this->finishFill(filler, false);
+		break;
+	default:
+		break;
 	}
 }
 
-// via web fixed time
-void BottleFiller::startManualFill(uint8_t fillerId, uint32_t time)
+// starts at once when a pump slot is free, otherwise the filler waits in the pending heap
+void BottleFiller::requestStart(FillerConfig *filler, const FillCommand &command)
 {
-	std::map<uint8_t, FillerConfig *>::iterator it;
-	it = this->fillers.find(fillerId);
-
-	if (it == this->fillers.end())
+	if (this->pendingCount == 0 && this->pumpSlotFree(esp_timer_get_time()))
 	{
-		// doesn't exist anymore, just ignore
-		ESP_LOGW(TAG, "Filler doesn't exist anymore, just ignore %d", fillerId);
+		this->startByType(filler, command.Type, command);
 		return;
 	}
 
-	FillerConfig *filler = it->second;
-
-	if (filler->status != Idle)
+	if (this->pendingCount == this->pendingStarts.size())
 	{
-		ESP_LOGW(TAG, "Filler must be idle %d", fillerId);
+		ESP_LOGE(TAG, "Pending starts full, start for %d dropped", filler->id);
 		return;
 	}
 
-	uint16_t fillSpeed = (this->maxDuty / 100) * filler->manualFillSpeed;
+	filler->status = Waiting;
+	filler->generation++;
 
-	ledc_set_duty(LEDC_LOW_SPEED_MODE, (ledc_channel_t)filler->channel, fillSpeed);
-	ledc_update_duty(LEDC_LOW_SPEED_MODE, (ledc_channel_t)filler->channel);
+	PendingStart pending;
+	pending.QueuedAt = command.QueuedAt;
+	pending.Type = command.Type;
+	pending.FillerId = filler->id;
+	pending.Generation = filler->generation;
 
-	vTaskDelay(pdMS_TO_TICKS(time));
+	this->pendingStarts[this->pendingCount++] = pending;
+	std::push_heap(this->pendingStarts.begin(), this->pendingStarts.begin() + this->pendingCount, std::greater<PendingStart>());
 
-	// stop
-	ledc_set_duty(LEDC_LOW_SPEED_MODE, (ledc_channel_t)filler->channel, 0);
-	ledc_update_duty(LEDC_LOW_SPEED_MODE, (ledc_channel_t)filler->channel);
+	ESP_LOGI(TAG, "Fill Waiting %d Queue:%d", filler->id, this->pendingCount);
 }
 
-// for push button until release
-void BottleFiller::startManualFill(uint8_t fillerId)
+void BottleFiller::startByType(FillerConfig *filler, FillCommandType type, const FillCommand &command)
+{
+	switch (type)
+	{
+	case StartFill:
+		// the batch can complete or the bottle can be taken away while this start was waiting
+		if (!filler->batchComplete() && !filler->bottleMissing())
+		{
+			this->startFill(filler, this->buildFillRun(filler), command);
+		}
+		break;
+	case PrimeFill:
+		this->startTimedFill(filler, filler->manualDuty, filler->primeTime, command);
+		break;
+	case TopUpFill:
+		this->startTimedFill(filler, filler->autoDuty, filler->topUpTime, command);
+		break;
+	default:
+		break;
+	}
+}
+
+uint8_t BottleFiller::getRunningPumps()
 {
-	std::map<uint8_t, FillerConfig *>::iterator it;
-	it = this->fillers.find(fillerId);
+	uint8_t running = 0;
 
-	if (it == this->fillers.end())
+	for (FillerConfig *filler : this->fillers)
 	{
-		// doesn't exist anymore, just ignore
-		ESP_LOGW(TAG, "Filler doesn't exist anymore, just ignore %d", fillerId);
-		return;
+		if (filler->status == Filling || filler->status == ManualFilling)
+		{
+			running++;
+		}
 	}
 
-	FillerConfig *filler = it->second;
+	return running;
+}
 
-	if (filler->status != Idle)
+bool BottleFiller::pumpSlotFree(int64_t now)
+{
+	if (this->maxConcurrentPumps > 0 && this->getRunningPumps() >= this->maxConcurrentPumps)
 	{
-		ESP_LOGW(TAG, "Filler must be idle %d", fillerId);
-		return;
+		return false;
 	}
 
-	uint16_t fillSpeed = (this->maxDuty / 100) * filler->manualFillSpeed;
+	return now >= this->lastPumpStart + ((int64_t)this->staggerTime * 1000);
+}
+
+// runs after every scheduler wake, a finished fill or a passed stagger time lets the next one go
+void BottleFiller::startPending()
+{
+	while (this->pendingCount > 0)
+	{
+		PendingStart pending = this->pendingStarts[0];
+		FillerConfig *filler = this->fillers.Get(pending.FillerId);
+
+		bool stale = (filler == nullptr || filler->status != Waiting || filler->generation != pending.Generation);
+
+		int64_t now = esp_timer_get_time();
+
+		if (!stale && !this->pumpSlotFree(now))
+		{
+			// only the stagger time needs a wake up, a full slot frees when a fill ends
+			bool slotsFull = this->maxConcurrentPumps > 0 && this->getRunningPumps() >= this->maxConcurrentPumps;
+			int64_t wakeAt = this->lastPumpStart + ((int64_t)this->staggerTime * 1000);
+
+			if (!slotsFull && wakeAt != this->staggerWakeAt)
+			{
+				FillDeadline deadline = {};
+				deadline.At = wakeAt;
+				deadline.Type = Stagger;
+				this->deadlines.push(deadline);
+				this->staggerWakeAt = wakeAt;
+			}
+			return;
+		}
+
+		std::pop_heap(this->pendingStarts.begin(), this->pendingStarts.begin() + this->pendingCount, std::greater<PendingStart>());
+		this->pendingCount--;
+
+		if (stale)
+		{
+			// aborted or reconfigured while waiting
+			continue;
+		}
+
+		this->lastStartWait = now - pending.QueuedAt;
+		this->maxStartWait = std::max(this->maxStartWait, this->lastStartWait);
+		this->delayedStarts++;
+
+		// latency is measured from here, the wait is reported separately
+		FillCommand command = {};
+		command.Type = pending.Type;
+		command.FillerId = pending.FillerId;
+		command.QueuedAt = now;
+
+		filler->status = Idle;
+		this->startByType(filler, pending.Type, command);
 
-	ledc_set_duty(LEDC_LOW_SPEED_MODE, (ledc_channel_t)filler->channel, fillSpeed);
-	ledc_update_duty(LEDC_LOW_SPEED_MODE, (ledc_channel_t)filler->channel);
+		ESP_LOGI(TAG, "Fill Started after waiting %d Wait:%lldus", filler->id, this->lastStartWait);
+	}
 }
 
-void BottleFiller::stopManualFill(uint8_t fillerId)
+// publishes a changed copy of a filler config, a running fill goes on with the state it already has
+void BottleFiller::swapConfig(FillerConfig *filler)
 {
-	std::map<uint8_t, FillerConfig *>::iterator it;
-	it = this->fillers.find(fillerId);
+	FillerConfig *current = this->fillers.Get(filler->id);
 
-	if (it == this->fillers.end())
+	if (current == nullptr)
 	{
-		// doesn't exist anymore, just ignore
-		ESP_LOGW(TAG, "Filler doesn't exist anymore, just ignore %d", fillerId);
+		// removed while the change was queued
+		delete filler;
 		return;
 	}
 
-	FillerConfig *filler = it->second;
+	filler->adoptRuntime(current);
+	this->updateFillerDuty(filler);
+	this->fillers.Publish(filler);
 
-	// stop
-	ledc_set_duty(LEDC_LOW_SPEED_MODE, (ledc_channel_t)filler->channel, 0);
-	ledc_update_duty(LEDC_LOW_SPEED_MODE, (ledc_channel_t)filler->channel);
+	ESP_LOGI(TAG, "Filler %d settings swapped", filler->id);
 }
 
-string BottleFiller::bootIntoRecovery()
+void BottleFiller::startTimedFill(FillerConfig *filler, uint16_t duty, uint32_t time, const FillCommand &command)
 {
-	// recovery is our factory
-	esp_partition_subtype_t t = ESP_PARTITION_SUBTYPE_APP_FACTORY;
-	const esp_partition_t *factory_partition = esp_partition_find_first(ESP_PARTITION_TYPE_APP, t, NULL);
+	FillRun run = {};
+	run.Mode = TimeMode;
+	run.Stages[0].Amount = time;
+	run.Stages[0].Duty = duty;
+	run.StageCount = 1;
 
-	if (factory_partition == NULL)
+	this->startFill(filler, run, command);
+}
+
+// the auto fill as configured, falls back to time mode when the sensor is missing
+FillRun BottleFiller::buildFillRun(FillerConfig *filler)
+{
+	FillRun run = {};
+	run.Mode = TimeMode;
+	run.Auto = true;
+	run.Stages[0].Amount = filler->fillTime;
+
+	if (filler->fillMode == FlowMode && filler->flowMeter != nullptr)
 	{
-		ESP_LOGE(TAG, "Factory Partition not found!");
-		return "Error: Factory Partition not found!";
+		run.Mode = FlowMode;
+		run.Stages[0].Amount = filler->targetVolume;
+	}
+	else if (filler->fillMode == WeightMode && filler->scale != nullptr)
+	{
+		run.Mode = WeightMode;
+		run.Stages[0].Amount = filler->targetWeight;
+	}
+	else if (filler->fillMode != TimeMode)
+	{
+		// the stages are in ml or g, they would run as ms
+		ESP_LOGW(TAG, "Filler %d has no sensor for mode %d, filling for fillTime", filler->id, filler->fillMode);
 	}
 
-	if (esp_ota_set_boot_partition(factory_partition) == ESP_OK)
+	if (filler->stageCount > 0 && run.Mode == filler->fillMode)
 	{
-		return "Device is booting into recovery hold on!";
+		std::copy(filler->stages, filler->stages + filler->stageCount, run.Stages);
+		run.StageCount = filler->stageCount;
+	}
+	else
+	{
+		run.Stages[0].Duty = filler->autoDuty;
+		run.StageCount = 1;
 	}
 
-	return "Error: Unable to chage boot Partition!";
+	return run;
 }
 
-void BottleFiller::reboot(void *arg)
+void BottleFiller::startFill(FillerConfig *filler, const FillRun &run, const FillCommand &command)
 {
-	vTaskDelay(2000 / portTICK_PERIOD_MS);
-	esp_restart();
-}
+	this->armFill(filler, run, esp_timer_get_time());
+	this->rampPumpDuty(filler, run.Stages[0].Duty, filler->rampUpTime);
 
-void BottleFiller::addDefaultFillers()
-{
-	auto defaultFiller1 = new FillerConfig();
-	defaultFiller1->id = 1;
-	defaultFiller1->name = "Filler 1";
-	defaultFiller1->pumpPin = (gpio_num_t)CONFIG_PUMP1;
-	// defaultFiller1->autoPin = (gpio_num_t)39;
-	// defaultFiller1->manualPin = (gpio_num_t)38;
-	defaultFiller1->autoFillSpeed = 100;
-	defaultFiller1->manualFillSpeed = 50;
-	defaultFiller1->fillTime = 20000;
-	this->fillers.insert_or_assign(defaultFiller1->id, defaultFiller1);
+	this->lastStartLatency = esp_timer_get_time() - command.QueuedAt;
+	this->maxStartLatency = std::max(this->maxStartLatency, this->lastStartLatency);
 
-	auto defaultFiller2 = new FillerConfig();
-	defaultFiller2->id = 2;
-	defaultFiller2->name = "Filler 2";
-	defaultFiller2->pumpPin = (gpio_num_t)CONFIG_PUMP2;
-	// defaultFiller2->autoPin = (gpio_num_t)37;
-	// defaultFiller2->manualPin = (gpio_num_t)36;
-	defaultFiller2->autoFillSpeed = 100;
-	defaultFiller2->manualFillSpeed = 50;
-	defaultFiller2->fillTime = 20000;
-	this->fillers.insert_or_assign(defaultFiller2->id, defaultFiller2);
+	ESP_LOGI(TAG, "Fill Started %d Mode:%d Stages:%d Compensation:%ld Latency:%lldus", filler->id, run.Mode, run.StageCount, filler->run.Compensation, this->lastStartLatency);
 }
 
-void BottleFiller::readFillerSettings()
+// all fillers share one start time, so fills of the same length end in the same scheduler wake
+void BottleFiller::startGangFill(const FillCommand &command)
 {
-	vector<uint8_t> empty = json::to_msgpack(json::array({}));
-	vector<uint8_t> serialized = this->settingsManager->Read("fillers", empty);
+	vector<FillerConfig *> gang;
+	int64_t startedAt = esp_timer_get_time();
+
+	// the gang starts together, the stagger time doesn't split it, the pump limit does
+	uint8_t running = this->getRunningPumps();
+
+	for (FillerConfig *filler : this->fillers)
+	{
+		if (filler->id >= 32 || (command.FillerMask & (1UL << filler->id)) == 0)
+		{
+			continue;
+		}
+
+		if (filler->status != Idle)
+		{
+			// unlike a single start this never aborts, a busy head just sits this one out
+			ESP_LOGW(TAG, "Gang Fill skips %d, not idle %d", filler->id, filler->status.load());
+			continue;
+		}
+
+		if (filler->batchComplete() || filler->bottleMissing())
+		{
+			continue;
+		}
+
+		if (this->maxConcurrentPumps > 0 && running >= this->maxConcurrentPumps)
+		{
+			FillCommand pending = command;
+			pending.Type = StartFill;
+			this->requestStart(filler, pending);
+			continue;
+		}
+
+		this->armFill(filler, this->buildFillRun(filler), startedAt);
+		gang.push_back(filler);
+		running++;
+	}
+
+	if (gang.empty())
+	{
+		return;
+	}
+
+	bool ramped = false;
+	for (auto filler : gang)
+	{
+		ramped = ramped || (pumpRampsEnabled && filler->rampUpTime > 0);
+	}
+
+	// write all duties first and latch them back to back, nothing else runs between the channels
+	if (!ramped)
+	{
+		for (auto filler : gang)
+		{
+#if SOC_LEDC_SUPPORT_FADE_STOP
+			ledc_fade_stop(filler->pwm.SpeedMode, filler->pwm.Channel);
+#endif
+			ledc_set_duty(filler->pwm.SpeedMode, filler->pwm.Channel, filler->run.Stages[0].Duty);
+		}
+
+		for (auto filler : gang)
+		{
+			ledc_update_duty(filler->pwm.SpeedMode, filler->pwm.Channel);
+		}
+	}
+	else
+	{
+		for (auto filler : gang)
+		{
+			this->rampPumpDuty(filler, filler->run.Stages[0].Duty, filler->rampUpTime);
+		}
+	}
+
+	this->lastStartLatency = esp_timer_get_time() - command.QueuedAt;
+	this->maxStartLatency = std::max(this->maxStartLatency, this->lastStartLatency);
+
+	ESP_LOGI(TAG, "Gang Fill Started %d fillers, spread:%lldus Latency:%lldus", gang.size(), esp_timer_get_time() - startedAt, this->lastStartLatency);
+}
+
+// puts the filler in filling state and schedules its end, the caller starts the pump
+void BottleFiller::armFill(FillerConfig *filler, const FillRun &run, int64_t startedAt)
+{
+	filler->status = Filling;
+	filler->generation++;
+	filler->run = run;
+	filler->run.Stage = 0;
+	filler->run.Compensation = fillCompensation(run.Mode, filler->overshoot[run.Mode], filler->inFlightWeight);
+	filler->run.CutoffValue = 0;
+
+	// arm before the pump starts so no pulse is missed
+	if (run.Mode == FlowMode)
+	{
+		filler->flowMeter->Arm(filler->run.StagePulses(filler->pulsesPerLiter));
+	}
+
+	// tare on the empty bottle, the scale task watches the net weight from here
+	if (run.Mode == WeightMode)
+	{
+		filler->tareValue = filler->scale->Value;
+		filler->weightReached = false;
+	}
+
+	filler->startedAt = startedAt;
+	this->lastPumpStart = startedAt;
+	this->watchPump(filler, startedAt);
+
+	// in time mode only the end of the first stage is scheduled, the next ones follow when it expires
+	// in flow and weight mode the sensor ends the stages and the fill time is only a limit
+	if (run.Mode == TimeMode)
+	{
+		this->pushStageDeadline(filler, filler->startedAt);
+	}
+	else
+	{
+		FillDeadline deadline;
+		deadline.At = filler->startedAt + ((int64_t)filler->fillTime * 1000);
+		deadline.Type = StageEnd;
+		deadline.FillerId = filler->id;
+		deadline.Generation = filler->generation;
+		this->deadlines.push(deadline);
+	}
+}
+
+// time mode end of the current stage
+void BottleFiller::pushStageDeadline(FillerConfig *filler, int64_t stageStart)
+{
+	FillDeadline deadline;
+	deadline.At = filler->run.StageEndsAt(stageStart);
+	deadline.Type = StageEnd;
+	deadline.FillerId = filler->id;
+	deadline.Generation = filler->generation;
+	this->deadlines.push(deadline);
+}
+
+// flow meter counted the volume of the current stage
+void BottleFiller::handleFlowReached(FillerConfig *filler)
+{
+	if (filler->status != Filling || filler->run.Mode != FlowMode)
+	{
+		return;
+	}
+
+	FillRun &run = filler->run;
+
+	// the count runs on over all stages, each stage target is added to the one just reached so no pulse is lost
+	// a stage that is already passed when it is entered is skipped
+	bool passed = true;
+
+	while (passed && run.Stage + 1 < run.StageCount)
+	{
+		run.Stage++;
+		passed = filler->flowMeter->Extend(filler->run.StagePulses(filler->pulsesPerLiter));
+	}
+
+	if (!passed)
+	{
+		this->setPumpDuty(filler, run.Stages[run.Stage].Duty);
+
+		ESP_LOGI(TAG, "Fill Stage %d %d", filler->id, run.Stage);
+		return;
+	}
+
+	this->finishFill(filler, false);
+
+	// the meter keeps counting after the cutoff, the settle deadline measures what still came through
+	uint32_t pulses = filler->flowMeter->GetPulses();
+	run.CutoffValue = pulses;
+	this->pushSettleDeadline(filler);
+
+	ESP_LOGI(TAG, "Fill Complete %d Pulses:%lu Volume:%luml Time:%lldus", filler->id, pulses, filler->pulsesToVolume(pulses), esp_timer_get_time() - filler->startedAt);
+}
+
+// scale task saw the weight of the current stage
+void BottleFiller::handleWeightReached(FillerConfig *filler)
+{
+	if (filler->status != Filling || filler->run.Mode != WeightMode)
+	{
+		return;
+	}
+
+	FillRun &run = filler->run;
+
+	if (run.Stage + 1 < run.StageCount)
+	{
+		// weight is not reset between stages, the scale task uses the cumulative target
+		run.Stage++;
+		filler->weightReached = false;
+		this->setPumpDuty(filler, run.Stages[run.Stage].Duty);
+
+		ESP_LOGI(TAG, "Fill Stage %d %d", filler->id, run.Stage);
+		return;
+	}
+
+	this->finishFill(filler, false);
+
+	run.CutoffValue = (int32_t)(filler->netWeight() * 1000);
+	this->pushSettleDeadline(filler);
+
+	ESP_LOGI(TAG, "Fill Complete %d Weight:%.1fg Time:%lldus", filler->id, filler->netWeight(), esp_timer_get_time() - filler->startedAt);
+}
+
+// samples all load cells and tells the scheduler when a weight fill reaches its target
+void BottleFiller::scaleLoop(void *arg)
+{
+	BottleFiller *instance = (BottleFiller *)arg;
+
+	while (true)
+	{
+		if (!instance->run || !instance->hasScales)
+		{
+			// initFillers wakes us when scales are configured
+			ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+			continue;
+		}
+
+		// the hx711 converts at 10 or 80 samples/s, one tick is fast enough to catch every sample
+		vTaskDelay(1);
+
+		FillerTable::ReadGuard guard(instance->fillers);
+
+		for (FillerConfig *filler : instance->fillers)
+		{
+			if (filler->scale == nullptr || !filler->scale->Update())
+			{
+				continue;
+			}
+
+			if (filler->status != Filling || filler->run.Mode != WeightMode || filler->weightReached)
+			{
+				continue;
+			}
+
+			if (filler->netWeight() >= filler->run.StageWeight())
+			{
+				filler->weightReached = true;
+				instance->postFillCommand(WeightReached, filler->id);
+			}
+		}
+	}
+}
+
+// stops the pump, an abort cuts at once and invalidates the pending deadlines
+void BottleFiller::finishFill(FillerConfig *filler, bool aborted)
+{
+	if (filler->status == Filling || filler->status == ManualFilling)
+	{
+		this->countFill(filler, aborted);
+	}
+
+	if (aborted)
+	{
+		this->setPumpDuty(filler, 0);
+		filler->generation++;
+	}
+	else
+	{
+		this->rampPumpDuty(filler, 0, filler->rampDownTime);
+	}
+
+	if (filler->flowMeter != nullptr)
+	{
+		filler->flowMeter->Disarm();
+	}
+
+	filler->stoppedAt = esp_timer_get_time();
+	filler->lastFillAborted = aborted;
+	filler->status = Idle;
+}
+
+// the settle time starts over on every sensor change, so a bottle that is still wobbling doesn't start a fill
+void BottleFiller::handleBottlePlaced(FillerConfig *filler)
+{
+	filler->bottlePresent = true;
+	filler->bottleToken++;
+
+	if (!filler->cycleArmed)
+	{
+		return;
+	}
+
+	FillDeadline deadline;
+	deadline.At = esp_timer_get_time() + ((int64_t)filler->settleTime * 1000);
+	deadline.Type = CycleStart;
+	deadline.FillerId = filler->id;
+	deadline.Generation = filler->bottleToken;
+	this->deadlines.push(deadline);
+}
+
+// a bottle taken away mid fill is an interlock, the pump stops at once
+void BottleFiller::handleBottleRemoved(FillerConfig *filler)
+{
+	filler->bottlePresent = false;
+	filler->cycleArmed = true;
+	filler->bottleToken++;
+
+	if (filler->status == Filling || filler->status == Waiting)
+	{
+		ESP_LOGW(TAG, "Bottle removed from %d, fill aborted", filler->id);
+		this->finishFill(filler, true);
+	}
+}
+
+void BottleFiller::startCycle(FillerConfig *filler)
+{
+	if (!filler->bottlePresent || !filler->cycleArmed || filler->status != Idle)
+	{
+		return;
+	}
+
+	// one fill per bottle, the next one needs a removal first
+	filler->cycleArmed = false;
+
+	if (filler->batchComplete())
+	{
+		ESP_LOGI(TAG, "Batch of %d complete, reset it to continue", filler->id);
+		return;
+	}
+
+	FillCommand command = {};
+	command.Type = StartFill;
+	command.FillerId = filler->id;
+	command.QueuedAt = esp_timer_get_time();
+
+	ESP_LOGI(TAG, "Cycle Start %d", filler->id);
+	this->requestStart(filler, command);
+}
+
+// only bottles of auto fills count, every pump run adds to the pump on time
+void BottleFiller::countFill(FillerConfig *filler, bool aborted)
+{
+	FillCounters &counters = filler->counters;
+	int64_t now = esp_timer_get_time();
+
+	counters.PumpOnTime += (now - filler->startedAt) / 1000;
+
+	uint32_t volume = 0;
+
+	if (filler->status == Filling && filler->run.Auto)
+	{
+		if (aborted)
+		{
+			counters.Aborted++;
+		}
+		else
+		{
+			counters.Completed++;
+			counters.BatchCount++;
+
+			if (counters.BatchCount == filler->batchTarget)
+			{
+				ESP_LOGI(TAG, "Batch Complete %d Bottles:%lu", filler->id, counters.BatchCount);
+			}
+		}
+
+		if (filler->run.Mode == FlowMode && filler->flowMeter != nullptr)
+		{
+			volume = filler->pulsesToVolume(filler->flowMeter->GetPulses());
+		}
+		else if (filler->run.Mode == WeightMode && filler->scale != nullptr)
+		{
+			volume = (uint32_t)std::max(filler->netWeight(), 0.0f);
+		}
+
+		counters.Volume += volume;
+	}
+
+	this->scheduleStatsFlush(now);
+
+	FillEvent event = {};
+	event.Type = FillEnded;
+	event.FillerId = filler->id;
+	event.Status = filler->status;
+	event.At = now;
+	event.Duration = (now - filler->startedAt) / 1000;
+	event.Volume = volume;
+	event.Aborted = aborted;
+	event.Manual = filler->status == ManualFilling;
+	this->publishEvent(event);
+}
+
+void BottleFiller::handleDeadlines()
+{
+	int64_t now = esp_timer_get_time();
+
+	while (!this->deadlines.empty() && this->deadlines.top().At <= now)
+	{
+		FillDeadline deadline = this->deadlines.top();
+		this->deadlines.pop();
+
+		if (deadline.Type == Flush)
+		{
+			this->flushStats(now);
+			continue;
+		}
+
+		if (deadline.Type == Watchdog)
+		{
+			this->watchdogArmed = false;
+			this->checkPumps(now);
+			continue;
+		}
+
+		if (deadline.Type == Stagger || deadline.Type == Reload)
+		{
+			// startPending and applyPendingConfigs run after this
+			continue;
+		}
+
+		FillerConfig *filler = this->fillers.Get(deadline.FillerId);
+
+		if (deadline.Type == CycleStart)
+		{
+			if (filler != nullptr && filler->bottleToken == deadline.Generation)
+			{
+				this->startCycle(filler);
+			}
+			continue;
+		}
+
+		if (deadline.Type == ManualEnd)
+		{
+			if (filler != nullptr && filler->generation == deadline.Generation && filler->status == ManualFilling)
+			{
+				this->finishFill(filler, false);
+				ESP_LOGI(TAG, "Manual Fill Complete %d Time:%lldus", filler->id, now - filler->startedAt);
+			}
+			continue;
+		}
+
+		if (deadline.Type == Settle)
+		{
+			// only learn from fills that ended normally and were left alone since
+			if (filler != nullptr && filler->generation == deadline.Generation && filler->status == Idle)
+			{
+				this->learnOvershoot(filler, now);
+			}
+			continue;
+		}
+
+		if (filler == nullptr || filler->generation != deadline.Generation || filler->status != Filling)
+		{
+			// aborted or reconfigured in the meantime
+			continue;
+		}
+
+		FillRun &run = filler->run;
+
+		if (run.Mode != TimeMode)
+		{
+			// the sensor should have ended it by now, no flow or a wrong calibration
+			this->finishFill(filler, true);
+			ESP_LOGW(TAG, "Fill Timeout %d, target not reached in %lums", filler->id, filler->fillTime);
+			continue;
+		}
+
+		if (run.Stage + 1 < run.StageCount)
+		{
+			run.Stage++;
+			this->setPumpDuty(filler, run.Stages[run.Stage].Duty);
+
+			// chain from the previous deadline so timer latency doesn't add up over the stages
+			this->pushStageDeadline(filler, deadline.At);
+
+			ESP_LOGI(TAG, "Fill Stage %d %d", filler->id, run.Stage);
+			continue;
+		}
+
+		// cut the pump first, logging can wait, the fill time ends where the ramp down starts
+		this->finishFill(filler, false);
+
+		int64_t elapsed = now - filler->startedAt;
+		int64_t cutoffError = now - deadline.At;
+
+		// in time mode the overshoot is how late we are, next fills are cut that much earlier
+		filler->overshoot[TimeMode].Update((int32_t)std::min<int64_t>(cutoffError, INT32_MAX));
+		this->scheduleStatsFlush(now);
+
+		ESP_LOGI(TAG, "Fill Complete %d Time:%lldus Error:%lldus Compensation:%ldus", filler->id, elapsed, cutoffError, run.Compensation);
+	}
+}
+
+// every pump start is watched until the pump is seen off again
+void BottleFiller::watchPump(FillerConfig *filler, int64_t now)
+{
+	filler->watched = true;
+	filler->flowPulses = filler->flowMeter != nullptr ? filler->flowMeter->GetPulses() : 0;
+
+	// no flow is expected while the pump is still spinning up
+	filler->flowSeenAt = now + ((int64_t)filler->rampUpTime * 1000);
+
+	if (this->watchdogArmed)
+	{
+		return;
+	}
+
+	this->watchdogArmed = true;
+
+	FillDeadline deadline = {};
+	deadline.At = now + watchdogInterval;
+	deadline.Type = Watchdog;
+	this->deadlines.push(deadline);
+}
+
+// one watchdog tick for all fillers, the deadline is only pushed again while a filler is watched
+void BottleFiller::checkPumps(int64_t now)
+{
+	bool watching = false;
+
+	for (FillerConfig *filler : this->fillers)
+	{
+		if (filler->watched && this->checkPump(filler, now))
+		{
+			watching = true;
+		}
+	}
+
+	if (!watching)
+	{
+		return;
+	}
+
+	this->watchdogArmed = true;
+
+	FillDeadline deadline = {};
+	deadline.At = now + watchdogInterval;
+	deadline.Type = Watchdog;
+	this->deadlines.push(deadline);
+}
+
+// stops a pump that runs too long or pumps nothing, and one that is still on after it was stopped
+// returns false once the pump is seen off
+bool BottleFiller::checkPump(FillerConfig *filler, int64_t now)
+{
+	FillerStatus status = filler->status;
+
+	if (status == Filling || status == ManualFilling)
+	{
+		int64_t maxPumpTime = this->getMaxPumpTime(filler);
+
+		if (maxPumpTime > 0 && now - filler->startedAt > maxPumpTime)
+		{
+			this->watchdogTrips++;
+			this->finishFill(filler, true);
+			ESP_LOGE(TAG, "Watchdog %d, pump on for %lldms in status %d, stopped", filler->id, (now - filler->startedAt) / 1000, status);
+			return true;
+		}
+
+		if (filler->flowMeter == nullptr || filler->noFlowTime == 0)
+		{
+			return true;
+		}
+
+		// any change counts, the meter is only reset when a fill starts
+		uint32_t pulses = filler->flowMeter->GetPulses();
+
+		if (pulses != filler->flowPulses)
+		{
+			filler->flowPulses = pulses;
+			filler->flowSeenAt = now;
+		}
+		else if (now - filler->flowSeenAt > (int64_t)filler->noFlowTime * 1000)
+		{
+			this->watchdogTrips++;
+			this->finishFill(filler, true);
+			ESP_LOGE(TAG, "No Flow %d for %dms, pump stopped", filler->id, filler->noFlowTime);
+		}
+
+		return true;
+	}
+
+	// a stopped pump may still ramp down
+	if (now < filler->stoppedAt + ((int64_t)filler->rampDownTime * 1000) + watchdogMargin)
+	{
+		return true;
+	}
+
+	filler->watched = false;
+
+	if (filler->pwm.Channel >= LEDC_CHANNEL_MAX || ledc_get_duty(filler->pwm.SpeedMode, filler->pwm.Channel) == 0)
+	{
+		return false;
+	}
+
+	this->watchdogTrips++;
+	this->setPumpDuty(filler, 0);
+
+	ESP_LOGE(TAG, "Watchdog %d, pump still on in status %d, forced off", filler->id, status);
+
+	return false;
+}
+
+// in us, how long the running fill may keep the pump on, 0 is no limit
+int64_t BottleFiller::getMaxPumpTime(FillerConfig *filler)
+{
+	if (filler->status == ManualFilling)
+	{
+		return (int64_t)filler->maxManualTime * 1000;
+	}
+
+	const FillRun &run = filler->run;
+
+	if (run.Mode != TimeMode)
+	{
+		// the fill time deadline should have ended it already
+		return ((int64_t)filler->fillTime * 1000) + watchdogMargin;
+	}
+
+	int64_t fillTime = 0;
+	for (uint8_t i = 0; i < run.StageCount; i++)
+	{
+		fillTime += (int64_t)run.Stages[i].Amount * 1000;
+	}
+
+	return fillTime + watchdogMargin;
+}
+
+void BottleFiller::pushSettleDeadline(FillerConfig *filler)
+{
+	FillDeadline deadline;
+	deadline.At = esp_timer_get_time() + overshootSettleTime;
+	deadline.Type = Settle;
+	deadline.FillerId = filler->id;
+	deadline.Generation = filler->generation;
+	this->deadlines.push(deadline);
+}
+
+// compares the settled flow or weight with the value at the cutoff
+void BottleFiller::learnOvershoot(FillerConfig *filler, int64_t now)
+{
+	const FillRun &run = filler->run;
+
+	int32_t settled = 0;
+
+	if (run.Mode == FlowMode && filler->flowMeter != nullptr)
+	{
+		settled = filler->flowMeter->GetPulses();
+	}
+	else if (run.Mode == WeightMode && filler->scale != nullptr)
+	{
+		settled = (int32_t)(filler->netWeight() * 1000);
+	}
+	else
+	{
+		return;
+	}
+
+	OvershootEstimator &estimator = filler->overshoot[run.Mode];
+	estimator.Update(settled - run.CutoffValue);
+	this->scheduleStatsFlush(now);
+
+	ESP_LOGI(TAG, "Overshoot %d Mode:%d Measured:%ld Estimate:%ld Samples:%d", filler->id, run.Mode, settled - run.CutoffValue, estimator.Get(), estimator.Samples);
+}
+
+// marks the learned values dirty, at most one write per interval
+void BottleFiller::scheduleStatsFlush(int64_t now)
+{
+	if (this->statsDirty)
+	{
+		return;
+	}
+
+	this->statsDirty = true;
+
+	FillDeadline deadline = {};
+	deadline.At = std::max(now, this->lastStatsFlush + statsFlushInterval);
+	deadline.Type = Flush;
+	this->deadlines.push(deadline);
+}
+
+void BottleFiller::flushStats(int64_t now)
+{
+	// a flash write stalls the cpu, don't do it while a pump has to be cut on time
+	for (FillerConfig *filler : this->fillers)
+	{
+		if (filler->status == Filling && now < this->lastStatsFlush + statsMaxFlushDelay)
+		{
+			FillDeadline deadline = {};
+			deadline.At = now + overshootSettleTime;
+			deadline.Type = Flush;
+			this->deadlines.push(deadline);
+			return;
+		}
+	}
+
+	this->statsDirty = false;
+	this->lastStatsFlush = now;
+	this->saveOvershoot();
+	this->saveCounters();
+}
+
+void BottleFiller::readCounters()
+{
+	vector<uint8_t> empty = json::to_msgpack(json::array({}));
+	vector<uint8_t> serialized = this->settingsManager->Read("counters", empty);
+
+	json jCounters = json::from_msgpack(serialized);
+
+	// [[id, completed, aborted, batchCount, pumpOnTime, volume], ...]
+	for (auto &el : jCounters.items())
+	{
+		auto jFiller = el.value();
+
+		if (!jFiller.is_array() || jFiller.size() != 6)
+		{
+			continue;
+		}
+
+		FillerConfig *filler = this->fillers.Get(jFiller[0].get<uint8_t>());
+
+		if (filler == nullptr)
+		{
+			continue;
+		}
+
+		filler->counters.Completed = jFiller[1].get<uint32_t>();
+		filler->counters.Aborted = jFiller[2].get<uint32_t>();
+		filler->counters.BatchCount = jFiller[3].get<uint32_t>();
+		filler->counters.PumpOnTime = jFiller[4].get<uint64_t>();
+		filler->counters.Volume = jFiller[5].get<uint64_t>();
+	}
+}
+
+void BottleFiller::saveCounters()
+{
+	json jCounters = json::array({});
+
+	for (FillerConfig *filler : this->fillers)
+	{
+		const FillCounters &counters = filler->counters;
+		jCounters.push_back(json::array({filler->id, counters.Completed, counters.Aborted, counters.BatchCount, counters.PumpOnTime, counters.Volume}));
+	}
+
+	vector<uint8_t> serialized = json::to_msgpack(jCounters);
+
+	this->settingsManager->Write("counters", serialized);
+}
+
+void BottleFiller::readOvershoot()
+{
+	vector<uint8_t> empty = json::to_msgpack(json::array({}));
+	vector<uint8_t> serialized = this->settingsManager->Read("overshoot", empty);
+
+	json jOvershoot = json::from_msgpack(serialized);
+
+	// [[id, [value, samples] per mode], ...]
+	for (auto &el : jOvershoot.items())
+	{
+		auto jFiller = el.value();
+
+		if (!jFiller.is_array() || jFiller.size() != 4 || !jFiller[0].is_number())
+		{
+			continue;
+		}
+
+		FillerConfig *filler = this->fillers.Get(jFiller[0].get<uint8_t>());
+
+		if (filler == nullptr)
+		{
+			continue;
+		}
+
+		for (uint8_t mode = 0; mode < 3; mode++)
+		{
+			auto jEstimator = jFiller[mode + 1];
+
+			if (!jEstimator.is_array() || jEstimator.size() != 2 || !jEstimator[0].is_number() || !jEstimator[1].is_number())
+			{
+				continue;
+			}
+
+			filler->overshoot[mode].Value = jEstimator[0].get<int32_t>();
+			filler->overshoot[mode].Samples = jEstimator[1].get<uint16_t>();
+		}
+	}
+}
+
+void BottleFiller::saveOvershoot()
+{
+	json jOvershoot = json::array({});
+
+	for (FillerConfig *filler : this->fillers)
+	{
+		json jFiller = json::array({filler->id});
+
+		for (uint8_t mode = 0; mode < 3; mode++)
+		{
+			jFiller.push_back(json::array({filler->overshoot[mode].Value, filler->overshoot[mode].Samples}));
+		}
+
+		jOvershoot.push_back(jFiller);
+	}
+
+	vector<uint8_t> serialized = json::to_msgpack(jOvershoot);
+
+	this->settingsManager->Write("overshoot", serialized);
+}
+
+void BottleFiller::armSchedulerTimer()
+{
+	esp_timer_stop(this->schedulerTimer);
+
+	if (this->deadlines.empty())
+	{
+		return;
+	}
+
+	int64_t wait = this->deadlines.top().At - esp_timer_get_time();
+
+	ESP_ERROR_CHECK_WITHOUT_ABORT(esp_timer_start_once(this->schedulerTimer, (uint64_t)std::max<int64_t>(wait, 0)));
+}
+
+// precompute the duty for every speed percentage, rounded so 100% is really full duty
+void BottleFiller::buildDutyTable()
+{
+	for (uint32_t speed = 0; speed <= 100; speed++)
+	{
+		this->speedDuty[speed] = ((this->maxDuty * speed) + 50) / 100;
+	}
+}
+
+// called whenever the speeds of a filler change, so starting a fill needs no math
+void BottleFiller::updateFillerDuty(FillerConfig *filler)
+{
+	filler->autoDuty = this->speedDuty[std::min<uint8_t>(filler->autoFillSpeed, 100)];
+	filler->manualDuty = this->speedDuty[std::min<uint8_t>(filler->manualFillSpeed, 100)];
+
+	for (uint8_t i = 0; i < filler->stageCount; i++)
+	{
+		filler->stages[i].Duty = this->speedDuty[filler->stages[i].Speed];
+	}
+}
+
+// sets the duty at once, also used to abort so it must cancel any running fade
+// without fade stop no fade is ever started, see pumpRampsEnabled
+void BottleFiller::setPumpDuty(FillerConfig *filler, uint32_t duty)
+{
+#if SOC_LEDC_SUPPORT_FADE_STOP
+	ledc_fade_stop(filler->pwm.SpeedMode, filler->pwm.Channel);
+#endif
+	// once the fade service is installed this is the thread safe way to set the duty
+	ledc_set_duty_and_update(filler->pwm.SpeedMode, filler->pwm.Channel, duty, 0);
+}
+
+// fades to the duty in hardware, no task has to step the duty
+void BottleFiller::rampPumpDuty(FillerConfig *filler, uint32_t duty, uint32_t fadeTime)
+{
+	if (fadeTime == 0 || !pumpRampsEnabled)
+	{
+		this->setPumpDuty(filler, duty);
+		return;
+	}
+
+#if SOC_LEDC_SUPPORT_FADE_STOP
+	ledc_fade_stop(filler->pwm.SpeedMode, filler->pwm.Channel);
+#endif
+	ledc_set_fade_with_time(filler->pwm.SpeedMode, filler->pwm.Channel, duty, fadeTime);
+	ledc_fade_start(filler->pwm.SpeedMode, filler->pwm.Channel, LEDC_FADE_NO_WAIT);
+}
+
+void BottleFiller::start(uint8_t fillerId)
+{
+	ESP_LOGI(TAG, "Start ID:%d", fillerId);
+
+	this->postFillCommand(StartFill, fillerId);
+}
+
+// via web fixed time, the scheduler stops it, returns the handle to poll or abort it
+uint32_t BottleFiller::startManualFill(uint8_t fillerId, uint32_t time)
+{
+	FillCommand command = {};
+	command.Type = StartManual;
+	command.FillerId = fillerId;
+	command.Handle = this->nextFillHandle++;
+	command.Time = time;
+	command.QueuedAt = esp_timer_get_time();
+
+	if (xQueueSend(this->fillQueue, &command, pdMS_TO_TICKS(100)) != pdTRUE)
+	{
+		ESP_LOGE(TAG, "Fill queue full, manual fill for %d dropped", fillerId);
+		return 0;
+	}
+
+	return command.Handle;
+}
+
+// handle 0 aborts whatever runs
+void BottleFiller::abortFill(uint8_t fillerId, uint32_t handle)
+{
+	FillCommand command = {};
+	command.Type = AbortFill;
+	command.FillerId = fillerId;
+	command.Handle = handle;
+	command.QueuedAt = esp_timer_get_time();
+
+	if (xQueueSend(this->fillQueue, &command, pdMS_TO_TICKS(100)) != pdTRUE)
+	{
+		ESP_LOGE(TAG, "Fill queue full, abort for %d dropped", fillerId);
+	}
+}
+
+// for push button until release
+void BottleFiller::startManualFill(uint8_t fillerId)
+{
+	this->postFillCommand(StartManual, fillerId);
+}
+
+void BottleFiller::stopManualFill(uint8_t fillerId)
+{
+	this->postFillCommand(StopManual, fillerId);
+}
+
+string BottleFiller::bootIntoRecovery()
+{
+	// recovery is our factory
+	esp_partition_subtype_t t = ESP_PARTITION_SUBTYPE_APP_FACTORY;
+	const esp_partition_t *factory_partition = esp_partition_find_first(ESP_PARTITION_TYPE_APP, t, NULL);
+
+	if (factory_partition == NULL)
+	{
+		ESP_LOGE(TAG, "Factory Partition not found!");
+		return "Error: Factory Partition not found!";
+	}
+
+	if (esp_ota_set_boot_partition(factory_partition) == ESP_OK)
+	{
+		return "Device is booting into recovery hold on!";
+	}
+
+	return "Error: Unable to chage boot Partition!";
+}
+
+void BottleFiller::reboot(void *arg)
+{
+	vTaskDelay(2000 / portTICK_PERIOD_MS);
+	esp_restart();
+}
+
+void BottleFiller::addDefaultFillers()
+{
+	auto defaultFiller1 = new FillerConfig();
+	defaultFiller1->id = 1;
+	defaultFiller1->name = "Filler 1";
+	defaultFiller1->pumpPin = (gpio_num_t)CONFIG_PUMP1;
+	// defaultFiller1->autoPin = (gpio_num_t)39;
+	// defaultFiller1->manualPin = (gpio_num_t)38;
+	defaultFiller1->autoFillSpeed = 100;
+	defaultFiller1->manualFillSpeed = 50;
+	defaultFiller1->fillTime = 20000;
+	this->fillers.Publish(defaultFiller1);
+
+	auto defaultFiller2 = new FillerConfig();
+	defaultFiller2->id = 2;
+	defaultFiller2->name = "Filler 2";
+	defaultFiller2->pumpPin = (gpio_num_t)CONFIG_PUMP2;
+	// defaultFiller2->autoPin = (gpio_num_t)37;
+	// defaultFiller2->manualPin = (gpio_num_t)36;
+	defaultFiller2->autoFillSpeed = 100;
+	defaultFiller2->manualFillSpeed = 50;
+	defaultFiller2->fillTime = 20000;
+	this->fillers.Publish(defaultFiller2);
+}
+
+void BottleFiller::readFillerSettings()
+{
+	vector<uint8_t> empty = json::to_msgpack(json::array({}));
+	vector<uint8_t> serialized = this->settingsManager->Read("fillers", empty);
+
+	json jFillers = json::from_msgpack(serialized);
+
+	if (jFillers.empty())
+	{
+		ESP_LOGI(TAG, "Adding Default Fillers");
+		this->addDefaultFillers();
+	}
+	else
+	{
+
+		for (auto &el : jFillers.items())
+		{
+			auto jFiller = el.value();
+
+			auto filler = new FillerConfig();
+			filler->from_json(jFiller);
+
+			uint8_t fillerId = filler->id;
+
+			// settings of a board with more pwm channels
+			if (fillerId == 0 || fillerId > MAX_FILLERS)
+			{
+				ESP_LOGE(TAG, "Only %d Fillers supported, skipping ID:%d", MAX_FILLERS, fillerId);
+				delete filler;
+				continue;
+			}
+
+			ESP_LOGI(TAG, "Filler From Settings ID:%d", fillerId);
+
+			this->fillers.Publish(filler);
+		}
+	}
+}
+
+void BottleFiller::setFillerSettings(json jFiller)
+{
+	ESP_LOGI(TAG, "Setting Filler Settings");
+
+	if (!jFiller.is_object())
+	{
+		ESP_LOGW(TAG, "Filler settings must be an object!");
+		return;
+	}
+
+	if (!jFiller["id"].is_number_unsigned() || jFiller["id"].get<uint32_t>() > MAX_FILLERS)
+	{
+		ESP_LOGW(TAG, "Filler settings without a valid id!");
+		return;
+	}
+
+	uint8_t fillerId = jFiller["id"].get<uint8_t>();
+
+	FillerConfig *current = this->fillers.Get(fillerId);
+
+	if (current == nullptr)
+	{
+		// doesn't exist anymore, just ignore
+		ESP_LOGW(TAG, "Filler doesn't exist anymore, just ignore %d", fillerId);
+		return;
+	}
+
+	// never write to a published config, change a copy and let the fill scheduler swap it in
+	auto filler = new FillerConfig();
+	filler->from_json(current->to_json());
+	filler->id = fillerId;
+
+	if (!jFiller["autoFillSpeed"].is_null() && jFiller["autoFillSpeed"].is_number())
+	{
+		filler->autoFillSpeed = std::clamp(jFiller["autoFillSpeed"].get<int>(), 0, 100);
+	}
+
+	if (!jFiller["manualFillSpeed"].is_null() && jFiller["manualFillSpeed"].is_number())
+	{
+		filler->manualFillSpeed = std::clamp(jFiller["manualFillSpeed"].get<int>(), 0, 100);
+	}
+
+	if (!jFiller["fillTime"].is_null() && jFiller["fillTime"].is_number())
+	{
+		filler->fillTime = jFiller["fillTime"].get<int>();
+	}
+
+	if (!jFiller["rampUpTime"].is_null() && jFiller["rampUpTime"].is_number())
+	{
+		filler->rampUpTime = jFiller["rampUpTime"].get<int>();
+	}
+
+	if (!jFiller["rampDownTime"].is_null() && jFiller["rampDownTime"].is_number())
+	{
+		filler->rampDownTime = jFiller["rampDownTime"].get<int>();
+	}
+
+	if (!jFiller["targetVolume"].is_null() && jFiller["targetVolume"].is_number())
+	{
+		filler->targetVolume = jFiller["targetVolume"].get<int>();
+	}
+
+	if (!jFiller["targetWeight"].is_null() && jFiller["targetWeight"].is_number())
+	{
+		filler->targetWeight = jFiller["targetWeight"].get<int>();
+	}
+
+	if (!jFiller["inFlightWeight"].is_null() && jFiller["inFlightWeight"].is_number())
+	{
+		filler->inFlightWeight = jFiller["inFlightWeight"].get<float>();
+	}
+
+	if (jFiller["stages"].is_array())
+	{
+		filler->stagesFromJson(jFiller["stages"]);
+	}
+
+	if (!jFiller["shortPressAction"].is_null() && jFiller["shortPressAction"].is_number())
+	{
+		filler->shortPressAction = (ButtonAction)jFiller["shortPressAction"].get<int>();
+	}
+
+	if (!jFiller["longPressAction"].is_null() && jFiller["longPressAction"].is_number())
+	{
+		filler->longPressAction = (ButtonAction)jFiller["longPressAction"].get<int>();
+	}
+
+	if (!jFiller["doublePressAction"].is_null() && jFiller["doublePressAction"].is_number())
+	{
+		filler->doublePressAction = (ButtonAction)jFiller["doublePressAction"].get<int>();
+	}
+
+	if (!jFiller["primeTime"].is_null() && jFiller["primeTime"].is_number())
+	{
+		filler->primeTime = jFiller["primeTime"].get<int>();
+	}
+
+	if (!jFiller["topUpTime"].is_null() && jFiller["topUpTime"].is_number())
+	{
+		filler->topUpTime = jFiller["topUpTime"].get<int>();
+	}
+
+	if (!jFiller["batchTarget"].is_null() && jFiller["batchTarget"].is_number())
+	{
+		filler->batchTarget = jFiller["batchTarget"].get<int>();
+	}
+
+	if (!jFiller["maxManualTime"].is_null() && jFiller["maxManualTime"].is_number())
+	{
+		filler->maxManualTime = jFiller["maxManualTime"].get<int>();
+	}
+
+	if (!jFiller["noFlowTime"].is_null() && jFiller["noFlowTime"].is_number())
+	{
+		filler->noFlowTime = jFiller["noFlowTime"].get<int>();
+	}
+
+	FillCommand command = {};
+	command.Type = SwapConfig;
+	command.FillerId = fillerId;
+	command.Config = filler;
+	command.QueuedAt = esp_timer_get_time();
+
+	if (xQueueSend(this->fillQueue, &command, pdMS_TO_TICKS(100)) != pdTRUE)
+	{
+		ESP_LOGE(TAG, "Fill queue full, settings for %d dropped", fillerId);
+		delete filler;
+		return;
+	}
+
+	this->responseCache.Invalidate(CachedFillerSettings);
+
+	ESP_LOGI(TAG, "Done Setting Filler Settings");
+}
+
+// applies saved settings while the line keeps running, only what changed is reconfigured
+// returns false when nothing was saved
+bool BottleFiller::saveFillerSettings(json jFillers)
+{
+	ESP_LOGI(TAG, "Saving Filler Settings");
+
+	if (!jFillers.is_array())
+	{
+		ESP_LOGW(TAG, "Filler settings must be an array!");
+		return false;
+	}
+
+	vector<FillerConfig *> newFillers;
+	uint8_t newId = 0;
+
+	for (auto &el : jFillers.items())
+	{
+		newId++;
+
+		if (newId > MAX_FILLERS)
+		{
+			ESP_LOGE(TAG, "Only %d Fillers supported!", MAX_FILLERS);
+			continue;
+		}
+
+		auto jFiller = el.value();
+		uint8_t fillerId = newId;
+		jFiller["id"] = fillerId;
+
+		auto filler = new FillerConfig();
+		filler->from_json(jFiller);
+		filler->id = fillerId;
+
+		newFillers.push_back(filler);
+	}
+
+	// the input task only restarts when an input really changed, built before the configs are handed over
+	vector<Input> newInputs = this->buildInputs(newFillers);
+
+	bool inputsChanged = newInputs.size() != this->inputs.size();
+	for (uint8_t i = 0; !inputsChanged && i < newInputs.size(); i++)
+	{
+		inputsChanged = !newInputs[i].SameConfig(this->inputs[i]);
+	}
+
+	// the inputs can't be swapped under a running task, keep the old settings
+	if (inputsChanged && !this->stopInputs())
+	{
+		for (auto filler : newFillers)
+		{
+			delete filler;
+		}
+
+		return false;
+	}
+
+	// Serialize to MessagePack for size
+	vector<uint8_t> serialized = json::to_msgpack(jFillers);
+
+	this->settingsManager->Write("fillers", serialized);
+
+	// the fill scheduler swaps them in, a running fill finishes first when its pins change
+	for (auto filler : newFillers)
+	{
+		this->postReload(filler->id, filler);
+	}
+
+	for (FillerConfig *filler : this->fillers)
+	{
+		if (filler->id > newFillers.size())
+		{
+			this->postReload(filler->id, nullptr);
+		}
+	}
+
+	if (inputsChanged)
+	{
+		this->clearInputs();
+		this->inputs = newInputs;
+		this->initInputs();
+	}
+
+	this->responseCache.Invalidate(CachedFillerSettings);
+
+	ESP_LOGI(TAG, "Saving Filler Settings Done");
+
+	return true;
+}
+
+void BottleFiller::postReload(uint8_t fillerId, FillerConfig *filler)
+{
+	FillCommand command = {};
+	command.Type = ReloadConfig;
+	command.FillerId = fillerId;
+	command.Config = filler;
+	command.QueuedAt = esp_timer_get_time();
+
+	if (xQueueSend(this->fillQueue, &command, pdMS_TO_TICKS(100)) != pdTRUE)
+	{
+		ESP_LOGE(TAG, "Fill queue full, settings for %d dropped", fillerId);
+		delete filler;
+	}
+}
+
+// scheduler task, settings on the same pins are swapped at once, others wait in pendingConfigs
+void BottleFiller::reloadFiller(const FillCommand &command)
+{
+	uint8_t slot = command.FillerId - 1;
+
+	if (command.FillerId == 0 || command.FillerId > MAX_FILLERS)
+	{
+		delete command.Config;
+		return;
+	}
+
+	// a newer save replaces whatever was still waiting
+	delete this->pendingConfigs[slot];
+	this->pendingConfigs[slot] = nullptr;
+	this->pendingRemovals &= ~(1UL << slot);
+
+	FillerConfig *current = this->fillers.Get(command.FillerId);
+
+	if (command.Config == nullptr)
+	{
+		this->pendingRemovals |= (1UL << slot);
+		return;
+	}
+
+	if (current != nullptr && command.Config->sameHardware(current))
+	{
+		// a running fill keeps its run, only the next one uses the new settings
+		command.Config->adoptRuntime(current);
+		this->updateFillerDuty(command.Config);
+		this->fillers.Publish(command.Config);
+
+		ESP_LOGI(TAG, "Filler %d settings reloaded", command.FillerId);
+		return;
+	}
+
+	this->pendingConfigs[slot] = command.Config;
+}
+
+// pin changes, additions and removals, a filler is only touched when it is idle
+void BottleFiller::applyPendingConfigs()
+{
+	bool retry = false;
+
+	for (uint8_t slot = 0; slot < MAX_FILLERS; slot++)
+	{
+		uint8_t fillerId = slot + 1;
+		FillerConfig *current = this->fillers.Get(fillerId);
+		FillerConfig *filler = this->pendingConfigs[slot];
+		bool remove = (this->pendingRemovals & (1UL << slot)) != 0;
+
+		if (filler == nullptr && !remove)
+		{
+			continue;
+		}
+
+		if (current != nullptr)
+		{
+			if (current->status != Idle)
+			{
+				// finishFill brings us back here
+				continue;
+			}
+
+			if (filler != nullptr)
+			{
+				filler->generation = current->generation + 1;
+				std::copy(current->overshoot, current->overshoot + 3, filler->overshoot);
+				filler->counters = current->counters;
+				filler->adoptCycle(current);
+			}
+
+			this->releaseFillerHardware(current);
+			this->pendingRemovals &= ~(1UL << slot);
+		}
+
+		if (filler == nullptr)
+		{
+			continue;
+		}
+
+		// the old sensors still hold their pins until the retired config is freed
+		if (this->fillers.HasRetired())
+		{
+			retry = true;
+			continue;
+		}
+
+		this->pendingConfigs[slot] = nullptr;
+		this->initFillerHardware(filler);
+		this->fillers.Publish(filler);
+
+		ESP_LOGI(TAG, "Filler %d reconfigured", fillerId);
+	}
+
+	if (retry)
+	{
+		FillDeadline deadline = {};
+		deadline.At = esp_timer_get_time() + 10000;
+		deadline.Type = Reload;
+		this->deadlines.push(deadline);
+	}
+
+	bool hasScales = false;
+	for (FillerConfig *filler : this->fillers)
+	{
+		hasScales = hasScales || filler->scale != nullptr;
+	}
+
+	if (hasScales && !this->hasScales && this->scaleTask != NULL)
+	{
+		this->hasScales = true;
+		xTaskNotifyGive(this->scaleTask);
+	}
+
+	this->hasScales = hasScales;
+}
+
+// pwm channel, flow meter and scale of one filler
+esp_err_t BottleFiller::initFillerHardware(FillerConfig *filler)
+{
+	if (!this->ledcAllocator.Allocate(&filler->pwm))
+	{
+		// can't happen when the filler count is checked, but never drive a channel twice
+		ESP_LOGE(TAG, "No pwm channel left for Filler:%d", filler->id);
+		return ESP_ERR_NOT_FOUND;
+	}
+
+	this->updateFillerDuty(filler);
+
+	ESP_LOGI(TAG, "Initilizing Filler:%d on Channel:%d Mode:%d", filler->id, filler->pwm.Channel, filler->pwm.SpeedMode);
+
+	if (!pumpRampsEnabled && (filler->rampUpTime > 0 || filler->rampDownTime > 0))
+	{
+		ESP_LOGW(TAG, "Filler:%d ramps ignored, this chip can't stop a fade", filler->id);
+	}
+
+	ledc_channel_config_t ledc_channel = {};
+	ledc_channel.speed_mode = filler->pwm.SpeedMode;
+	ledc_channel.channel = filler->pwm.Channel;
+	ledc_channel.timer_sel = filler->pwm.Timer;
+	ledc_channel.intr_type = LEDC_INTR_DISABLE;
+	ledc_channel.gpio_num = filler->pumpPin;
+	ledc_channel.duty = 0; // Set duty to 0
+	ledc_channel.hpoint = 0;
+	ledc_channel.flags.output_invert = 0;
+	ESP_ERROR_CHECK(ledc_channel_config(&ledc_channel));
+
+	if (filler->flowPin > 0)
+	{
+		auto flowMeter = new FlowMeter(filler->flowPin, filler->id);
+		flowMeter->OnTarget = &this->flowTargetReached;
+		flowMeter->OnTargetArg = this;
+
+		if (flowMeter->Init() == ESP_OK)
+		{
+			filler->flowMeter = flowMeter;
+		}
+		else
+		{
+			ESP_LOGE(TAG, "Flow meter of Filler:%d could not be initialized", filler->id);
+			delete flowMeter;
+		}
+	}
+
+	if (filler->scaleDataPin > 0 && filler->scaleClockPin > 0)
+	{
+		auto scale = new HX711(filler->scaleDataPin, filler->scaleClockPin);
+
+		if (scale->Init() == ESP_OK)
+		{
+			filler->scale = scale;
+		}
+		else
+		{
+			ESP_LOGE(TAG, "Scale of Filler:%d could not be initialized", filler->id);
+			delete scale;
+		}
+	}
+
+	return ESP_OK;
+}
+
+// takes the filler out of the table, its sensors are freed with the config
+void BottleFiller::releaseFillerHardware(FillerConfig *filler)
+{
+	this->setPumpDuty(filler, 0);
+
+	// detach the pin from the channel and keep the pump off
+	gpio_reset_pin(filler->pumpPin);
+	gpio_set_direction(filler->pumpPin, GPIO_MODE_OUTPUT);
+	gpio_set_level(filler->pumpPin, this->gpioLow);
+
+	this->ledcAllocator.Release(filler->pwm);
+	this->fillers.Remove(filler->id);
+}
+
+void BottleFiller::initFillers()
+{
+	this->hasScales = false;
+
+	// link our channel to our fillers, after loading
+	this->ledcAllocator.Reset();
+
+	vector<FillerConfig *> all;
+
+	for (FillerConfig *filler : this->fillers)
+	{
+		// a pump without a channel can't be switched, don't boot into that
+		ESP_ERROR_CHECK(this->initFillerHardware(filler));
+		this->hasScales = this->hasScales || filler->scale != nullptr;
+		all.push_back(filler);
+	}
+
+	this->inputs = this->buildInputs(all);
+}
+
+vector<Input> BottleFiller::buildInputs(const vector<FillerConfig *> &fillers)
+{
+	vector<Input> newInputs;
+
+	for (FillerConfig *filler : fillers)
+	{
+		if (filler->autoPin > 0)
+		{
+			this->addInput(newInputs, filler, AutoFill, filler->autoPin);
+		}
+
+		if (filler->manualPin > 0)
+		{
+			this->addInput(newInputs, filler, ManualFill, filler->manualPin);
+		}
+
+		if (filler->bottlePin > 0)
+		{
+			this->addInput(newInputs, filler, BottleSensor, filler->bottlePin);
+		}
+	}
+
+	return newInputs;
+}
+
+// ids are given out in order, starting at 1
+void BottleFiller::addInput(vector<Input> &inputs, FillerConfig *filler, InputFunction function, gpio_num_t gpio)
+{
+	Input newInput;
+	newInput.Id = inputs.size() + 1;
+	newInput.GpioNr = gpio;
+	newInput.FillerId = filler->id;
+	newInput.CurrentLevel = 1;
+	newInput.PendingLevel = 1;
+	newInput.LastChange = 0;
+	newInput.DebounceTime = filler->debounceTime;
+	newInput.MinPressTime = filler->minPressTime;
+	newInput.LongPressTime = filler->longPressTime;
+	newInput.ShortPending = false;
+	newInput.ShortPendingUntil = 0;
+	newInput.RejectedBounces = 0;
+	newInput.RejectedPresses = 0;
+	newInput.Function = function;
+	inputs.push_back(newInput); // add to map
+}
+
+void BottleFiller::initInputs()
+{
+
+	if (!inputs.empty())
+	{
+		// edges of the old inputs are meaningless now
+		this->inputEdges.Clear();
+
+		for (uint8_t i = 0; i < inputs.size(); i++)
+		{
+			Input &input = inputs[i];
+
+			ESP_LOGI(TAG, "Setting %d to input", input.GpioNr);
+
+			gpio_config_t io_conf = {};
+			io_conf.mode = GPIO_MODE_INPUT;
+			io_conf.pin_bit_mask = (1ULL << input.GpioNr);
+			io_conf.pull_up_en = GPIO_PULLUP_ENABLE;
+			io_conf.intr_type = GPIO_INTR_ANYEDGE;
+			gpio_config(&io_conf);
+
+			// a bottle sensor has no idle level, tell the scheduler where we start
+			// a bottle that is already there is never filled, it may be a full one
+			if (input.Function == BottleSensor)
+			{
+				input.CurrentLevel = gpio_get_level(input.GpioNr);
+				input.PendingLevel = input.CurrentLevel;
+				this->postFillCommand(input.CurrentLevel == 0 ? BottlePlaced : BottleRemoved, input.FillerId);
+			}
+		}
+
+		// start gpio task, the isr wakes it so it has to exist before the first edge
+		this->interruptRun = true;
+		xTaskCreate(&this->interruptLoop, "interruptLoop_task", 3072, this, 10, &this->inputTask);
+
+		// from here on the inputs belong to the input task
+		for (uint8_t i = 0; i < inputs.size(); i++)
+		{
+			// we pass the index of the input, so the isr doesn't need to search
+			gpio_isr_handler_add(inputs[i].GpioNr, &this->inputIsr, (void *)(uintptr_t)i);
+		}
+	}
+}
+
+// the input task exits on its next wake, this only waits for that instead of a fixed delay
+// returns false when it did not exit, the old inputs are running again then
+bool BottleFiller::stopInputs()
+{
+	// no edges for a task that is going away
+	for (const auto &input : inputs)
+	{
+		gpio_isr_handler_remove(input.GpioNr);
+	}
+
+	this->interruptRun = false;
+
+	for (uint8_t i = 0; i < 100 && this->inputTask != NULL; i++)
+	{
+		xTaskNotifyGive(this->inputTask);
+		vTaskDelay(1);
+	}
+
+	if (this->inputTask != NULL)
+	{
+		ESP_LOGE(TAG, "Input task did not stop");
+
+		// it is still running the old inputs, give it its edges back
+		this->interruptRun = true;
+		for (uint8_t i = 0; i < inputs.size(); i++)
+		{
+			gpio_isr_handler_add(inputs[i].GpioNr, &this->inputIsr, (void *)(uintptr_t)i);
+		}
+
+		return false;
+	}
+
+	return true;
+}
+
+void BottleFiller::clearInputs()
+{
+	this->inputs.clear();
+}
+
+// keep this short, we only capture the edge and wake the input task
+void BottleFiller::inputIsr(void *arg)
+{
+	BottleFiller *instance = mainInstance;
+
+	// the task is gone or not there yet, nobody would take the edge
+	TaskHandle_t inputTask = instance->inputTask;
+	if (inputTask == NULL)
+	{
+		return;
+	}
+
+	InputEdge edge;
+	edge.InputIndex = (uint8_t)(uintptr_t)arg;
+	edge.Level = gpio_get_level(instance->inputs[edge.InputIndex].GpioNr);
+	edge.Timestamp = esp_timer_get_time();
+
+	if (!instance->inputEdges.Push(edge))
+	{
+		instance->droppedEdges++;
+	}
+
+	BaseType_t higherPriorityTaskWoken = pdFALSE;
+	vTaskNotifyGiveFromISR(inputTask, &higherPriorityTaskWoken);
+	portYIELD_FROM_ISR(higherPriorityTaskWoken);
+}
+
+void BottleFiller::interruptLoop(void *arg)
+{
+	BottleFiller *instance = (BottleFiller *)arg;
+
+	TickType_t wait = portMAX_DELAY;
+
+	while (instance->run && instance->interruptRun)
+	{
+		// sleep until an edge arrives, or until the first pending debounce expires
+		ulTaskNotifyTake(pdTRUE, wait);
+
+		InputEdge edge;
+		while (instance->inputEdges.Pop(edge))
+		{
+			if (edge.InputIndex >= instance->inputs.size())
+			{
+				continue;
+			}
+
+			Input &input = instance->inputs[edge.InputIndex];
+
+			// went back before it was stable, contact bounce
+			if (input.PendingLevel != input.CurrentLevel && edge.Level == input.CurrentLevel)
+			{
+				input.RejectedBounces++;
+			}
+
+			input.PendingLevel = edge.Level;
+			input.PendingSince = edge.Timestamp;
+		}
+
+		int64_t now = esp_timer_get_time();
+		int64_t nextCheck = INT64_MAX;
+
+		FillerTable::ReadGuard guard(instance->fillers);
+
+		for (Input &input : instance->inputs)
+		{
+			// no second press came in time, it was a single short press
+			if (input.ShortPending)
+			{
+				if (now >= input.ShortPendingUntil)
+				{
+					input.ShortPending = false;
+
+					FillerConfig *filler = instance->fillers.Get(input.FillerId);
+					if (filler != nullptr)
+					{
+						instance->runButtonAction(input.FillerId, filler->shortPressAction);
+					}
+				}
+				else
+				{
+					nextCheck = std::min(nextCheck, input.ShortPendingUntil);
+				}
+			}
+
+			if (input.PendingLevel == input.CurrentLevel)
+			{
+				continue;
+			}
+
+			int64_t stableUntil = input.PendingSince + ((int64_t)input.DebounceTime * 1000);
+
+			if (now < stableUntil)
+			{
+				nextCheck = std::min(nextCheck, stableUntil);
+				continue;
+			}
+
+			// edges can be missed while bouncing, trust the pin over the last edge
+			uint8_t level = gpio_get_level(input.GpioNr);
+			input.PendingLevel = level;
+
+			if (level != input.CurrentLevel)
+			{
+				instance->handleInputChange(input, level, input.PendingSince);
+			}
+		}
+
+		if (nextCheck == INT64_MAX)
+		{
+			wait = portMAX_DELAY;
+		}
+		else
+		{
+			// round up so we never wake before the debounce time has passed
+			wait = pdMS_TO_TICKS(((nextCheck - now) / 1000) + 1) + 1;
+		}
+	}
+
+	instance->inputTask = NULL;
+	vTaskDelete(NULL);
+}
+
+void BottleFiller::handleInputChange(Input &input, uint8_t level, int64_t timestamp)
+{
+	if (input.Function == BottleSensor)
+	{
+		// no press classification, the debounced level is the bottle state
+		ESP_LOGI(TAG, "Bottle %d %s", input.FillerId, level == 0 ? "placed" : "removed");
+
+		this->postFillCommand(level == 0 ? BottlePlaced : BottleRemoved, input.FillerId);
+	}
+	else if (level > 0)
+	{
+		int64_t pressTime = timestamp - input.LastChange;
+		PressType pressType = this->classifyPress(input, pressTime);
+
+		ESP_LOGI(TAG, "Released %d %d Time:%lldms Type:%d", input.FillerId, input.Function, pressTime / 1000, pressType);
+
+		if (input.Function == AutoFill)
+		{
+			// a glitch must never start or abort a fill
+			if (pressType != GlitchPress)
+			{
+				this->handleGesture(input, pressType, timestamp);
+			}
+		}
+
+		else if (input.Function == ManualFill)
+		{
+			// always stop, even after a glitch the pump was started on press
+			this->stopManualFill(input.FillerId);
+		}
+	}
+	else
+	{
+		// high to low
+		ESP_LOGI(TAG, "Pressed %d %d", input.FillerId, input.Function);
+
+		if (input.Function == ManualFill)
+		{
+			this->startManualFill(input.FillerId);
+		}
+	}
+
+	input.CurrentLevel = level;
+	input.LastChange = timestamp;
+}
+
+void BottleFiller::handleGesture(Input &input, PressType pressType, int64_t timestamp)
+{
+	FillerConfig *filler = this->fillers.Get(input.FillerId);
+
+	if (filler == nullptr)
+	{
+		return;
+	}
+
+	if (pressType == LongPress)
+	{
+		input.ShortPending = false;
+		this->runButtonAction(input.FillerId, filler->longPressAction);
+		return;
+	}
+
+	// without a double press action there is nothing to wait for
+	if (filler->doublePressAction == ActionNone)
+	{
+		this->runButtonAction(input.FillerId, filler->shortPressAction);
+		return;
+	}
+
+	if (input.ShortPending && timestamp <= input.ShortPendingUntil)
+	{
+		input.ShortPending = false;
+		this->runButtonAction(input.FillerId, filler->doublePressAction);
+		return;
+	}
+
+	// wait for a possible second press, the input loop fires the short action when this expires
+	input.ShortPending = true;
+	input.ShortPendingUntil = timestamp + ((int64_t)filler->doublePressTime * 1000);
+}
+
+void BottleFiller::runButtonAction(uint8_t fillerId, ButtonAction action)
+{
+	ESP_LOGI(TAG, "Button Action %d %d", fillerId, action);
+
+	switch (action)
+	{
+	case ActionStart:
+		this->start(fillerId);
+		break;
+	case ActionAbort:
+		this->postFillCommand(AbortFill, fillerId);
+		break;
+	case ActionPrime:
+		this->postFillCommand(PrimeFill, fillerId);
+		break;
+	case ActionTopUp:
+		this->postFillCommand(TopUpFill, fillerId);
+		break;
+	default:
+		break;
+	}
+}
+
+PressType BottleFiller::classifyPress(Input &input, int64_t pressTime)
+{
+	if (pressTime < ((int64_t)input.MinPressTime * 1000))
+	{
+		input.RejectedPresses++;
+		return GlitchPress;
+	}
+
+	if (pressTime >= ((int64_t)input.LongPressTime * 1000))
+	{
+		return LongPress;
+	}
+
+	return ShortPress;
+}
+
+// the counters belong to the fill scheduler, these read the copy it published
+json BottleFiller::getFillerStatsJson()
+{
+	std::array<FillerSnapshot, MAX_FILLERS> snapshot;
+	uint32_t version = 0;
+	uint8_t count = this->statusSnapshot.Read(snapshot, version);
+
+	SchedulerSnapshot scheduler;
+	this->statusSnapshot.ReadScheduler(scheduler);
+
+	json jFillers = json::array({});
+
+	for (uint8_t i = 0; i < count; i++)
+	{
+		const FillerSnapshot &entry = snapshot[i];
+
+		json jOvershoot = json::array({});
+
+		for (uint8_t mode = 0; mode < 3; mode++)
+		{
+			json jEstimator;
+			jEstimator["mode"] = mode;
+			jEstimator["estimate"] = entry.OvershootEstimate[mode];
+			jEstimator["samples"] = entry.OvershootSamples[mode];
+			jOvershoot.push_back(jEstimator);
+		}
+
+		json jFiller;
+		jFiller["id"] = entry.Id;
+		jFiller["overshoot"] = jOvershoot;
+		jFillers.push_back(jFiller);
+	}
+
+	json jStats;
+	jStats["fillers"] = jFillers;
+	jStats["lastStartLatency"] = scheduler.LastStartLatency;
+	jStats["maxStartLatency"] = scheduler.MaxStartLatency;
+
+	return jStats;
+}
+
+json BottleFiller::getCountersJson()
+{
+	std::array<FillerSnapshot, MAX_FILLERS> snapshot;
+	uint32_t version = 0;
+	uint8_t count = this->statusSnapshot.Read(snapshot, version);
+
+	json jFillers = json::array({});
+
+	for (uint8_t i = 0; i < count; i++)
+	{
+		const FillerSnapshot &entry = snapshot[i];
+
+		json jFiller;
+		jFiller["id"] = entry.Id;
+		jFiller["completed"] = entry.Completed;
+		jFiller["aborted"] = entry.Aborted;
+		jFiller["pumpOnTime"] = entry.PumpOnTime;
+		jFiller["volume"] = entry.Volume;
+		jFiller["batchCount"] = entry.BatchCount;
+		jFiller["batchTarget"] = entry.BatchTarget;
+		jFiller["batchComplete"] = entry.BatchTarget > 0 && entry.BatchCount >= entry.BatchTarget;
+		jFillers.push_back(jFiller);
+	}
+
+	return jFillers;
+}
+
+// state of a manual fill by handle, handles only go up so a newer one not seen yet is still queued
+json BottleFiller::getManualFillJson(uint8_t fillerId, uint32_t handle)
+{
+	json jFill;
+	jFill["id"] = fillerId;
+	jFill["handle"] = handle;
+	jFill["state"] = "unknown";
+
+	FillerSnapshot entry;
+
+	if (handle == 0 || !this->statusSnapshot.ReadFiller(fillerId, entry))
+	{
+		return jFill;
+	}
+
+	int64_t now = esp_timer_get_time();
+
+	if (handle == entry.FillHandle)
+	{
+		if (entry.Status == ManualFilling)
+		{
+			jFill["state"] = "running";
+			jFill["elapsed"] = (now - entry.StartedAt) / 1000;
+
+			if (entry.EndsAt > 0)
+			{
+				jFill["remaining"] = std::max<int64_t>(entry.EndsAt - now, 0) / 1000;
+			}
+		}
+		else
+		{
+			jFill["state"] = entry.LastFillAborted ? "aborted" : "done";
+		}
+	}
+	else if (handle == entry.RefusedHandle)
+	{
+		jFill["state"] = "refused";
+	}
+	else if (handle > entry.FillHandle && handle > entry.RefusedHandle && handle < this->nextFillHandle)
+	{
+		jFill["state"] = "queued";
+	}
+
+	return jFill;
+}
+
+// copies what clients need into the snapshot, the push task is only woken when something changed
+void BottleFiller::publishStatus()
+{
+	std::array<FillerSnapshot, MAX_FILLERS> snapshot;
+	uint8_t count = 0;
+
+	for (FillerConfig *filler : this->fillers)
+	{
+		FillerSnapshot &entry = snapshot[count++];
+		entry.Id = filler->id;
+		entry.Status = filler->status;
+		// only a running pump has a start, a waiting or stopped filler still holds the one of its last fill
+		bool pumping = entry.Status == Filling || entry.Status == ManualFilling;
+		entry.StartedAt = pumping ? filler->startedAt : 0;
+		entry.EndsAt = this->getFillEndsAt(filler);
+		entry.Completed = filler->counters.Completed;
+		entry.Aborted = filler->counters.Aborted;
+		entry.BatchCount = filler->counters.BatchCount;
+		entry.BatchTarget = filler->batchTarget;
+		entry.PumpOnTime = filler->counters.PumpOnTime;
+		entry.Volume = filler->counters.Volume;
+		entry.FillHandle = filler->fillHandle;
+		entry.RefusedHandle = filler->refusedHandle;
+		entry.LastFillAborted = filler->lastFillAborted;
+
+		for (uint8_t mode = 0; mode < 3; mode++)
+		{
+			entry.OvershootEstimate[mode] = filler->overshoot[mode].Get();
+			entry.OvershootSamples[mode] = filler->overshoot[mode].Samples;
+		}
+
+		FillerStatus &sentStatus = this->eventStatus[filler->id - 1];
+
+		if (entry.Status != sentStatus)
+		{
+			FillEvent event = {};
+			event.Type = StateChanged;
+			event.FillerId = filler->id;
+			event.Status = entry.Status;
+			event.PreviousStatus = sentStatus;
+			event.At = esp_timer_get_time();
+			this->publishEvent(event);
+
+			sentStatus = entry.Status;
+		}
+	}
+
+	if (this->statusSnapshot.Publish(snapshot, count) && this->statusTask != NULL)
+	{
+		xTaskNotifyGive(this->statusTask);
+	}
+
+	SchedulerSnapshot scheduler = {};
+
+	for (uint8_t i = 0; i < this->pendingCount && scheduler.PendingCount < scheduler.Pending.size(); i++)
+	{
+		const PendingStart &pending = this->pendingStarts[i];
+		FillerConfig *filler = this->fillers.Get(pending.FillerId);
+
+		// stale ones are dropped when they reach the top of the heap, they don't wait anymore
+		if (filler != nullptr && filler->status == Waiting && filler->generation == pending.Generation)
+		{
+			scheduler.Pending[scheduler.PendingCount++] = pending;
+		}
+	}
+
+	// the heap has no order a client can use
+	std::sort(scheduler.Pending.begin(), scheduler.Pending.begin() + scheduler.PendingCount, [](const PendingStart &a, const PendingStart &b)
+			  { return b > a; });
+
+	scheduler.RunningPumps = this->getRunningPumps();
+	scheduler.LastStartWait = this->lastStartWait;
+	scheduler.MaxStartWait = this->maxStartWait;
+	scheduler.DelayedStarts = this->delayedStarts;
+	scheduler.WatchdogTrips = this->watchdogTrips;
+	scheduler.LastStartLatency = this->lastStartLatency;
+	scheduler.MaxStartLatency = this->maxStartLatency;
+
+	this->statusSnapshot.PublishScheduler(scheduler);
+}
+
+// in us, only time based fills know their end
+int64_t BottleFiller::getFillEndsAt(FillerConfig *filler)
+{
+	if (filler->status == ManualFilling)
+	{
+		return filler->manualEndsAt;
+	}
+
+	if (filler->status != Filling)
+	{
+		return 0;
+	}
+
+	return filler->run.EndsAt(filler->startedAt);
+}
+
+// compact frame, one array per filler: [id, status, elapsed ms, remaining ms or -1, completed, aborted, batch]
+json BottleFiller::getStatusJson()
+{
+	std::array<FillerSnapshot, MAX_FILLERS> snapshot;
+	uint32_t version = 0;
+	uint8_t count = this->statusSnapshot.Read(snapshot, version);
+
+	int64_t now = esp_timer_get_time();
+
+	json jFillers = json::array({});
+
+	for (uint8_t i = 0; i < count; i++)
+	{
+		const FillerSnapshot &entry = snapshot[i];
+
+		int64_t elapsed = entry.StartedAt > 0 ? (now - entry.StartedAt) / 1000 : 0;
+		int64_t remaining = entry.EndsAt > 0 ? std::max<int64_t>(entry.EndsAt - now, 0) / 1000 : -1;
+
+		jFillers.push_back(json::array({entry.Id, entry.Status, elapsed, remaining, entry.Completed, entry.Aborted, entry.BatchCount}));
+	}
+
+	json jStatus;
+	jStatus["type"] = "status";
+	jStatus["version"] = version;
+	jStatus["fillers"] = jFillers;
+
+	return jStatus;
+}
+
+// one frame for all clients, serialized once and handed to the httpd task to send
+void BottleFiller::statusPushLoop(void *arg)
+{
+	BottleFiller *instance = (BottleFiller *)arg;
+
+	uint32_t sentVersion = 0;
+	bool running = false;
+
+	while (true)
+	{
+		// a change wakes us at once, a running pump also refreshes the times
+		ulTaskNotifyTake(pdTRUE, running ? pdMS_TO_TICKS(statusRefreshInterval) : portMAX_DELAY);
+
+		if (instance->server == NULL)
+		{
+			continue;
+		}
+
+		std::array<FillerSnapshot, MAX_FILLERS> snapshot;
+		uint32_t version = 0;
+		uint8_t count = instance->statusSnapshot.Read(snapshot, version);
+
+		running = false;
+		for (uint8_t i = 0; i < count; i++)
+		{
+			running = running || snapshot[i].Status != Idle;
+		}
+
+		if (version == sentVersion && !running && !instance->statusForce)
+		{
+			continue;
+		}
+
+		instance->statusForce = false;
+		sentVersion = version;
+
+		// freed by statusBroadcast
+		string *frame = new string(instance->getStatusJson().dump());
+
+		if (httpd_queue_work(instance->server, &instance->statusBroadcast, frame) != ESP_OK)
+		{
+			delete frame;
+		}
+
+		// caps the rate, whatever changes in the meantime goes out with the next frame
+		vTaskDelay(pdMS_TO_TICKS(statusMinInterval));
+	}
+}
+
+// runs in the httpd task, sends the frame to every open websocket
+void BottleFiller::statusBroadcast(void *arg)
+{
+	string *frame = (string *)arg;
+
+	int clientFds[maxStatusClients];
+	size_t clients = maxStatusClients;
+
+	if (httpd_get_client_list(mainInstance->server, &clients, clientFds) == ESP_OK)
+	{
+		httpd_ws_frame_t wsFrame = {};
+		wsFrame.final = true;
+		wsFrame.type = HTTPD_WS_TYPE_TEXT;
+		wsFrame.payload = (uint8_t *)frame->c_str();
+		wsFrame.len = frame->length();
+
+		for (size_t i = 0; i < clients; i++)
+		{
+			if (httpd_ws_get_fd_info(mainInstance->server, clientFds[i]) != HTTPD_WS_CLIENT_WEBSOCKET)
+			{
+				continue;
+			}
+
+			// a client that went away is cleaned up by the server, nothing to track here
+			httpd_ws_send_frame_async(mainInstance->server, clientFds[i], &wsFrame);
+		}
+	}
+
+	delete frame;
+}
+
+void BottleFiller::publishEvent(const FillEvent &event)
+{
+	if (this->eventStream.Publish(event) && this->eventTask != NULL)
+	{
+		xTaskNotifyGive(this->eventTask);
+	}
+}
+
+// drains the backlog of every event client, a failed send ends the stream
+void BottleFiller::eventPushLoop(void *arg)
+{
+	BottleFiller *instance = (BottleFiller *)arg;
+
+	char buf[256];
+
+	while (true)
+	{
+		bool keepAlive = ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(eventKeepAliveInterval)) == 0;
+
+		for (EventStream::Client &client : instance->eventStream.Clients)
+		{
+			if (!client.Active.load())
+			{
+				continue;
+			}
+
+			esp_err_t ret = ESP_OK;
+
+			uint32_t dropped = client.Backlog.TakeDropped();
+			if (dropped > 0)
+			{
+				snprintf(buf, sizeof(buf), "event: dropped\ndata: {\"count\":%lu}\n\n", dropped);
+				ret = httpd_resp_send_chunk(client.Request, buf, HTTPD_RESP_USE_STRLEN);
+			}
+
+			FillEvent event;
+			while (ret == ESP_OK && client.Backlog.Pop(event))
+			{
+				int length = formatEvent(event, buf, sizeof(buf));
+				ret = httpd_resp_send_chunk(client.Request, buf, length);
+			}
+
+			if (ret == ESP_OK && keepAlive)
+			{
+				ret = httpd_resp_send_chunk(client.Request, ": keepalive\n\n", HTTPD_RESP_USE_STRLEN);
+			}
+
+			if (ret != ESP_OK)
+			{
+				httpd_req_t *request = client.Request;
+				instance->eventStream.Remove(client);
+				httpd_req_async_handler_complete(request);
+
+				ESP_LOGI(TAG, "Event client gone");
+			}
+		}
+	}
+}
 
-	json jFillers = json::from_msgpack(serialized);
+// one event in server-sent events format, times in ms since boot
+int BottleFiller::formatEvent(const FillEvent &event, char *buf, size_t size)
+{
+	int length = 0;
 
-	if (jFillers.empty())
+	if (event.Type == StateChanged)
 	{
-		ESP_LOGI(TAG, "Adding Default Fillers");
-		this->addDefaultFillers();
+		length = snprintf(buf, size, "id: %lu\nevent: state\ndata: {\"id\":%d,\"status\":%d,\"previous\":%d,\"at\":%lld}\n\n",
+						  event.Seq, event.FillerId, event.Status, event.PreviousStatus, event.At / 1000);
 	}
 	else
 	{
+		length = snprintf(buf, size, "id: %lu\nevent: fill\ndata: {\"id\":%d,\"aborted\":%s,\"manual\":%s,\"duration\":%lu,\"volume\":%lu,\"at\":%lld}\n\n",
+						  event.Seq, event.FillerId, event.Aborted ? "true" : "false", event.Manual ? "true" : "false", event.Duration, event.Volume, event.At / 1000);
+	}
 
-		for (auto &el : jFillers.items())
-		{
-			auto jFiller = el.value();
+	return std::min<int>(length, size - 1);
+}
 
-			auto filler = new FillerConfig();
-			filler->from_json(jFiller);
+json BottleFiller::getSchedulerStatusJson()
+{
+	int64_t now = esp_timer_get_time();
 
-			uint8_t fillerId = filler->id;
+	// the pending heap belongs to the fill scheduler, use the copy it published
+	SchedulerSnapshot scheduler;
+	this->statusSnapshot.ReadScheduler(scheduler);
 
-			ESP_LOGI(TAG, "Filler From Settings ID:%d", fillerId);
+	json jPending = json::array({});
 
-			this->fillers.insert_or_assign(fillerId, filler);
-		}
+	for (uint8_t i = 0; i < scheduler.PendingCount; i++)
+	{
+		const PendingStart &pending = scheduler.Pending[i];
+
+		json jStart;
+		jStart["id"] = pending.FillerId;
+		jStart["type"] = pending.Type;
+		jStart["waiting"] = now - pending.QueuedAt;
+		jPending.push_back(jStart);
 	}
+
+	json jStatus;
+	jStatus["maxConcurrentPumps"] = this->maxConcurrentPumps;
+	jStatus["staggerTime"] = this->staggerTime;
+	jStatus["runningPumps"] = scheduler.RunningPumps;
+	jStatus["queueDepth"] = scheduler.PendingCount;
+	jStatus["pending"] = jPending;
+	jStatus["lastStartWait"] = scheduler.LastStartWait;
+	jStatus["maxStartWait"] = scheduler.MaxStartWait;
+	jStatus["delayedStarts"] = scheduler.DelayedStarts;
+	jStatus["watchdogTrips"] = scheduler.WatchdogTrips;
+
+	return jStatus;
 }
 
-void BottleFiller::setFillerSettings(json jFiller)
+json BottleFiller::getInputStatsJson()
 {
-	ESP_LOGI(TAG, "Setting Filler Settings");
+	json jInputs = json::array({});
 
-	if (!jFiller.is_object())
+	for (const auto &input : this->inputs)
 	{
-		ESP_LOGW(TAG, "Filler settings must be an object!");
-		return;
+		json jInput;
+		jInput["id"] = input.Id;
+		jInput["fillerId"] = input.FillerId;
+		jInput["function"] = input.Function;
+		jInput["gpio"] = input.GpioNr;
+		jInput["rejectedBounces"] = input.RejectedBounces;
+		jInput["rejectedPresses"] = input.RejectedPresses;
+		jInputs.push_back(jInput);
 	}
 
-	uint8_t fillerId = jFiller["id"];
+	json jStats;
+	jStats["inputs"] = jInputs;
+	jStats["droppedEdges"] = this->droppedEdges;
 
-	std::map<uint8_t, FillerConfig *>::iterator it;
-	it = this->fillers.find(fillerId);
-
-	if (it == this->fillers.end())
-	{
-		// doesn't exist anymore, just ignore
-		ESP_LOGW(TAG, "Filler doesn't exist anymore, just ignore %d", fillerId);
-		return;
-	}
+	return jStats;
+}
 
-	FillerConfig *filler = it->second;
+// every command runCommand has a case for, a new command has to be added here too
+static constexpr ApiCommandName apiCommands[] = {
+	"Start",
+	"StartGang",
+	"StartManual",
+	"GetManualFill",
+	"AbortFill",
+	"GetStatus",
+	"GetCounters",
+	"GetFillerStats",
+	"GetInputStats",
+	"GetSchedulerStatus",
+	"ResetBatch",
+	"ResetCounters",
+	"ResetOvershoot",
+	"GetWifiSettings",
+	"SaveWifiSettings",
+	"ScanWifi",
+	"GetSystemSettings",
+	"SaveSystemSettings",
+	"GetFillerSettings",
+	"SaveFillerSettings",
+	"SetFillerSettings",
+	"Reboot",
+	"FactoryReset",
+	"BootIntoRecovery",
+#if CONFIG_API_BENCHMARK
+	"BenchmarkApi",
+#endif
+};
 
-	if (!jFiller["autoFillSpeed"].is_null() && jFiller["autoFillSpeed"].is_number())
+// commands that get their data as json, the others only read the scalars the parser picked out
+bool BottleFiller::commandNeedsData(uint32_t hash)
+{
+	switch (hash)
 	{
-		filler->autoFillSpeed = jFiller["autoFillSpeed"].get<int>();
+	case commandHash("StartGang"):
+	case commandHash("SaveWifiSettings"):
+	case commandHash("SaveSystemSettings"):
+	case commandHash("SaveFillerSettings"):
+	case commandHash("SetFillerSettings"):
+		return true;
+	default:
+		return false;
 	}
+}
 
-	if (!jFiller["manualFillSpeed"].is_null() && jFiller["manualFillSpeed"].is_number())
+bool BottleFiller::commandNeedsId(uint32_t hash)
+{
+	switch (hash)
 	{
-		filler->manualFillSpeed = jFiller["manualFillSpeed"].get<int>();
+	case commandHash("Start"):
+	case commandHash("StartManual"):
+	case commandHash("GetManualFill"):
+	case commandHash("AbortFill"):
+	case commandHash("ResetBatch"):
+	case commandHash("ResetCounters"):
+	case commandHash("ResetOvershoot"):
+		return true;
+	default:
+		return false;
 	}
+}
 
-	if (!jFiller["fillTime"].is_null() && jFiller["fillTime"].is_number())
+bool BottleFiller::commandCached(uint32_t hash, CachedCommand &command)
+{
+	switch (hash)
 	{
-		filler->fillTime = jFiller["fillTime"].get<int>();
+	case commandHash("GetFillerSettings"):
+		command = CachedFillerSettings;
+		return true;
+	case commandHash("GetSystemSettings"):
+		command = CachedSystemSettings;
+		return true;
+	case commandHash("GetWifiSettings"):
+		command = CachedWifiSettings;
+		return true;
+	default:
+		return false;
 	}
-
-	ESP_LOGI(TAG, "Done Setting Filler Settings");
 }
 
-void BottleFiller::saveFillerSettings(json jFillers)
+// the filler settings follow the table version, the scheduler swaps a saved config in after the save returned
+const ResponseCache::Entry *BottleFiller::cachedResponse(ApiRequest &request, CachedCommand command)
 {
-	ESP_LOGI(TAG, "Saving Filler Settings");
+	uint32_t version = command == CachedFillerSettings ? this->fillers.Version() : 0;
 
-	if (!jFillers.is_array())
+	const ResponseCache::Entry *entry = this->responseCache.Get(command, version);
+
+	if (entry == nullptr)
 	{
-		ESP_LOGW(TAG, "Filler settings must be an array!");
-		return;
+		entry = this->responseCache.Store(command, version, this->runCommand(request));
 	}
 
-	// put everything on hold
-	this->run = false;
-	this->interruptRun = false;
-
-	// wait for stop
-	vTaskDelay(pdMS_TO_TICKS(1000));
-
-	// clear
-	this->fillers.clear();
-	this->inputs.clear();
+	return entry;
+}
 
-	uint8_t newId = 0;
+// written straight into the string, the result data is not copied into a second dom
+string BottleFiller::resultPayload(const json &data, bool success, const string &message)
+{
+	string payload;
+	payload.reserve(48 + message.length());
+	payload += "{\"data\":";
+	payload += data.is_null() ? "null" : data.dump();
+	payload += success ? ",\"success\":true" : ",\"success\":false";
 
-	// update running data
-	for (auto &el : jFillers.items())
+	if (message != "")
 	{
-		newId++;
+		payload += ",\"message\":";
+		payload += json(message).dump();
+	}
 
-		if (newId > 6)
-		{
-			ESP_LOGE(TAG, "Only 6 Fillers supported!");
-			continue;
-		}
+	payload += "}";
 
-		auto jFiller = el.value();
-		uint8_t fillerId = newId;
-		jFiller["id"] = fillerId;
+	return payload;
+}
 
-		auto filler = new FillerConfig();
-		filler->from_json(jFiller);
-		filler->id = fillerId;
+#if CONFIG_API_BENCHMARK
+// parse, dispatch and response of the old dom path against the sax path, handlers are not run
+json BottleFiller::benchmarkApi()
+{
+	static const char *payloads[] = {
+		"{\"command\":\"Start\",\"data\":{\"id\":1}}",
+		"{\"command\":\"StartManual\",\"data\":{\"id\":1,\"time\":1000}}",
+		"{\"command\":\"GetManualFill\",\"data\":{\"id\":1,\"handle\":3}}",
+		"{\"command\":\"GetFillerSettings\",\"data\":null}",
+		"{\"command\":\"SetFillerSettings\",\"data\":{\"id\":1,\"autoFillSpeed\":80,\"fillTime\":5000}}",
+	};
 
-		this->fillers.insert_or_assign(fillerId, filler);
-	}
+	// the old if/else chain, in its order
+	static const char *commands[] = {"Start", "StartGang", "StartManual", "GetManualFill", "AbortFill", "GetWifiSettings", "SaveWifiSettings",
+									  "ScanWifi", "GetSystemSettings", "SaveSystemSettings", "GetFillerSettings", "GetInputStats", "GetCounters",
+									  "ResetBatch", "ResetCounters", "GetStatus", "GetSchedulerStatus", "GetFillerStats", "ResetOvershoot",
+									  "SaveFillerSettings", "SetFillerSettings", "Reboot", "FactoryReset", "BootIntoRecovery"};
 
-	// Serialize to MessagePack for size
-	vector<uint8_t> serialized = json::to_msgpack(jFillers);
+	const uint32_t iterations = 100;
 
-	this->settingsManager->Write("fillers", serialized);
+	json jResults = json::array({});
 
-	this->initFillers();
-	this->run = true;
+	for (const char *payload : payloads)
+	{
+		string payLoad = payload;
+		uint32_t matched = 0;
 
-	this->initInputs();
+		uint32_t allocations = benchmarkAllocations;
+		int64_t start = esp_timer_get_time();
 
-	ESP_LOGI(TAG, "Saving Filler Settings Done");
-}
+		for (uint32_t i = 0; i < iterations; i++)
+		{
+			string copy = payLoad; // was taken by value
+			json jCommand = json::parse(copy);
+			string command = jCommand["command"];
+			json data = jCommand["data"];
 
-void BottleFiller::initFillers()
-{
+			for (const char *name : commands)
+			{
+				if (command == name)
+				{
+					matched++;
+					break;
+				}
+			}
 
-	uint8_t nextInputId = 0;
-	// link our channel to our fillers, after loading or saving changes
-	for (auto const &[key, filler] : this->fillers)
-	{
-		uint8_t channelId = filler->id - 1;
-		filler->channel = channelId;
+			json jResultPayload;
+			jResultPayload["data"] = json({});
+			jResultPayload["success"] = true;
+			string resultPayload = jResultPayload.dump();
+		}
 
-		ESP_LOGI(TAG, "Initilizing Filler:%d on Channel:%d", filler->id, channelId);
+		int64_t domTime = (esp_timer_get_time() - start) / iterations;
+		uint32_t domAllocations = (benchmarkAllocations - allocations) / iterations;
 
-		ledc_channel_config_t ledc_channel = {};
-		ledc_channel.speed_mode = LEDC_LOW_SPEED_MODE;
-		ledc_channel.channel = (ledc_channel_t)channelId;
-		ledc_channel.timer_sel = LEDC_TIMER_0;
-		ledc_channel.intr_type = LEDC_INTR_DISABLE;
-		ledc_channel.gpio_num = filler->pumpPin;
-		ledc_channel.duty = 0; // Set duty to 0
-		ledc_channel.hpoint = 0;
-		ledc_channel.flags.output_invert = 0;
-		ESP_ERROR_CHECK(ledc_channel_config(&ledc_channel));
+		allocations = benchmarkAllocations;
+		start = esp_timer_get_time();
 
-		if (filler->autoPin > 0)
+		for (uint32_t i = 0; i < iterations; i++)
 		{
-			nextInputId++;
-			Input newInput;
-			newInput.Id = nextInputId;
-			newInput.GpioNr = (gpio_num_t)filler->autoPin;
-			newInput.FillerId = filler->id;
-			newInput.CurrentLevel = 1;
-			newInput.Function = AutoFill;
-			inputs.push_back(newInput); // add to map
-		}
+			ApiRequest request;
+			ApiRequestParser parser(request, &BottleFiller::commandNeedsData);
+			json::sax_parse(payLoad, &parser);
 
-		if (filler->manualPin > 0)
-		{
-			nextInputId++;
-			Input newInput;
-			newInput.Id = nextInputId;
-			newInput.GpioNr = (gpio_num_t)filler->manualPin;
-			newInput.FillerId = filler->id;
-			newInput.CurrentLevel = 1;
-			newInput.Function = ManualFill;
-			inputs.push_back(newInput); // add to map
+			if (parser.Complete() && commandNeedsId(request.CommandHash) == request.HasId)
+			{
+				matched++;
+			}
+
+			string result = resultPayload(nullptr, true, "");
 		}
+
+		int64_t saxTime = (esp_timer_get_time() - start) / iterations;
+		uint32_t saxAllocations = (benchmarkAllocations - allocations) / iterations;
+
+		json jResult;
+		jResult["payload"] = payLoad;
+		jResult["domUs"] = domTime;
+		jResult["domAllocations"] = domAllocations;
+		jResult["saxUs"] = saxTime;
+		jResult["saxAllocations"] = saxAllocations;
+		jResult["matched"] = matched;
+		jResults.push_back(jResult);
 	}
+
+	return jResults;
 }
+#endif
 
-void BottleFiller::initInputs()
+// the command name is hashed once and dispatched by a switch, no string compares
+string BottleFiller::runCommand(ApiRequest &request)
 {
+	ESP_LOGD(TAG, "runCommand %s", request.Command);
 
-	if (!inputs.empty())
-	{
-
-		for (const auto &input : inputs)
-		{
-			ESP_LOGI(TAG, "Setting %d to input", input.GpioNr);
+	json &data = request.Data;
+	json resultData = {};
+	string message = "";
+	bool success = true;
 
-			gpio_config_t io_conf = {};
-			io_conf.mode = GPIO_MODE_INPUT;
-			io_conf.pin_bit_mask = (1ULL << input.GpioNr);
-			io_conf.pull_up_en = GPIO_PULLUP_ENABLE;
-			gpio_config(&io_conf);
-		}
+	if (!commandKnown(apiCommands, request))
+	{
+		return resultPayload(nullptr, false, "Unknown command");
+	}
 
-		// start gpio task
-		this->interruptRun = true;
-		xTaskCreate(&this->interruptLoop, "interruptLoop_task", 2048, this, 10, NULL);
+	if (commandNeedsId(request.CommandHash) && !request.HasId)
+	{
+		return resultPayload(nullptr, false, "Missing id");
 	}
-}
 
-void BottleFiller::interruptLoop(void *arg)
-{
-	BottleFiller *instance = (BottleFiller *)arg;
-	// gpio_num_t gpioNr;
+	// filler pointers loaded below stay valid until we return
+	FillerTable::ReadGuard guard(this->fillers);
 
-	while (instance->run && instance->interruptRun)
+	switch (request.CommandHash)
+	{
+	case commandHash("Start"):
 	{
-		vTaskDelay(pdMS_TO_TICKS(100));
+		this->start(request.Id);
+		break;
+	}
+	case commandHash("StartGang"):
+	{
+		// no ids starts every filler
+		uint32_t fillerMask = 0;
 
-		for (Input &input : instance->inputs)
+		if (data.is_object() && data["ids"].is_array())
 		{
-			uint32_t timestamp = xTaskGetTickCount() / 100; // we only need whole seconds
-			uint8_t level = gpio_get_level((gpio_num_t)input.GpioNr);
-
-			if (input.CurrentLevel != level)
+			for (auto &el : data["ids"].items())
 			{
-				if (level > 0)
+				if (!el.value().is_number_unsigned())
 				{
-					uint32_t elapsedTime = timestamp - input.LastChange;
-
-					ESP_LOGI(TAG, "Released %d %d Time:%lu", input.FillerId, input.Function, elapsedTime);
-
-					if (input.Function == AutoFill)
-					{
-						instance->start(input.FillerId);
-					}
-
-					else if (input.Function == ManualFill)
-					{
-						instance->stopManualFill(input.FillerId);
-					}
+					success = false;
+					break;
 				}
-				else
-				{
-					// high to low
-					input.LastChange = timestamp;
-					ESP_LOGI(TAG, "Pressed %d %d", input.FillerId, input.Function);
 
-					if (input.Function == ManualFill)
-					{
-						instance->startManualFill(input.FillerId);
-					}
+				uint32_t id = el.value().get<uint32_t>();
+				if (id < 32)
+				{
+					fillerMask |= (1UL << id);
 				}
-
-				input.CurrentLevel = level;
 			}
 		}
-	}
-
-	vTaskDelete(NULL);
-}
-
-string BottleFiller::processCommand(string payLoad)
-{
-	ESP_LOGD(TAG, "payLoad %s", payLoad.c_str());
+		else
+		{
+			fillerMask = UINT32_MAX;
+		}
 
-	json jCommand = json::parse(payLoad);
-	string command = jCommand["command"];
-	json data = jCommand["data"];
+		if (!success)
+		{
+			// nothing is started when one id is wrong
+			message = "Invalid filler id";
+			break;
+		}
 
-	ESP_LOGD(TAG, "processCommand %s", command.c_str());
-	ESP_LOGD(TAG, "data %s", data.dump().c_str());
+		this->postGangFill(fillerMask);
+		break;
+	}
+	case commandHash("StartManual"):
+	{
+		if (!request.HasTime || request.Time == 0)
+		{
+			success = false;
+			message = "Missing time";
+			break;
+		}
 
-	json resultData = {};
-	string message = "";
-	bool success = true;
+		uint8_t id = request.Id;
+		uint32_t handle = this->startManualFill(id, request.Time); // ms
 
-	if (command == "Start")
+		if (handle == 0)
+		{
+			success = false;
+			message = "Fill queue full";
+		}
+		else
+		{
+			resultData["id"] = id;
+			resultData["handle"] = handle;
+		}
+		break;
+	}
+	case commandHash("GetManualFill"):
 	{
-		uint8_t id = data["id"].get<uint>();
-		this->start(id);
+		resultData = this->getManualFillJson(request.Id, request.Handle);
+		break;
 	}
-	else if (command == "StartManual")
+	case commandHash("AbortFill"):
 	{
-		uint8_t id = data["id"].get<uint>();
-		uint32_t time = data["time"].get<uint>(); // ms
-		this->startManualFill(id, time);
+		// without a handle whatever runs is aborted
+		this->abortFill(request.Id, request.Handle);
+		break;
 	}
-	else if (command == "GetWifiSettings")
+	case commandHash("GetWifiSettings"):
 	{
 		// get data from wifi-connect
 		if (this->GetWifiSettingsJson)
 		{
 			resultData = this->GetWifiSettingsJson();
 		}
+		break;
 	}
-	else if (command == "SaveWifiSettings")
+	case commandHash("SaveWifiSettings"):
 	{
 		// save via wifi-connect
 		if (this->SaveWifiSettingsJson)
 		{
 			this->SaveWifiSettingsJson(data);
+			this->responseCache.Invalidate(CachedWifiSettings);
 		}
 		message = "Please restart device for changes to have effect!";
+		break;
 	}
-	else if (command == "ScanWifi")
+	case commandHash("ScanWifi"):
 	{
 		// scans for networks
 		if (this->ScanWifiJson)
 		{
 			resultData = this->ScanWifiJson();
 		}
+		break;
 	}
-	else if (command == "GetSystemSettings")
+	case commandHash("GetSystemSettings"):
 	{
 		resultData = {
-			{"invertOutputs", this->invertOutputs}};
+			{"invertOutputs", this->invertOutputs},
+			{"maxConcurrentPumps", this->maxConcurrentPumps},
+			{"staggerTime", this->staggerTime}};
+		break;
 	}
-	else if (command == "SaveSystemSettings")
+	case commandHash("SaveSystemSettings"):
 	{
-		this->saveSystemSettingsJson(data);
+		if (!this->saveSystemSettingsJson(data))
+		{
+			success = false;
+			message = "Invalid system settings";
+			break;
+		}
 		message = "Please restart device for changes to have effect!";
+		break;
 	}
-	else if (command == "GetFillerSettings")
+	case commandHash("GetFillerSettings"):
 	{
 		// Convert sensors to json
 		json jFillers = json::array({});
 
-		for (auto const &[key, val] : this->fillers)
+		for (FillerConfig *val : this->fillers)
 		{
 			json jFiller = val->to_json();
 			jFillers.push_back(jFiller);
 		}
 
 		resultData = jFillers;
+		break;
+	}
+	case commandHash("GetInputStats"):
+	{
+		resultData = this->getInputStatsJson();
+		break;
+	}
+	case commandHash("GetCounters"):
+	{
+		resultData = this->getCountersJson();
+		break;
+	}
+	case commandHash("ResetBatch"):
+	{
+		this->postFillCommand(ResetBatch, request.Id);
+		break;
+	}
+	case commandHash("ResetCounters"):
+	{
+		this->postFillCommand(ResetCounters, request.Id);
+		break;
+	}
+	case commandHash("GetStatus"):
+	{
+		resultData = this->getStatusJson();
+		break;
+	}
+	case commandHash("GetSchedulerStatus"):
+	{
+		resultData = this->getSchedulerStatusJson();
+		break;
+	}
+	case commandHash("GetFillerStats"):
+	{
+		resultData = this->getFillerStatsJson();
+		break;
+	}
+	case commandHash("ResetOvershoot"):
+	{
+		this->postFillCommand(ResetOvershoot, request.Id);
+		break;
 	}
-	else if (command == "SaveFillerSettings")
+	case commandHash("SaveFillerSettings"):
 	{
-		this->saveFillerSettings(data);
+		if (!this->saveFillerSettings(data))
+		{
+			success = false;
+			message = "Filler settings not saved";
+		}
+		break;
 	}
-	else if (command == "SetFillerSettings")
+	case commandHash("SetFillerSettings"):
 	{
 		this->setFillerSettings(data);
+		break;
 	}
-	else if (command == "Reboot")
+	case commandHash("Reboot"):
 	{
 		xTaskCreate(&this->reboot, "reboot_task", 1024, this, 5, NULL);
+		break;
 	}
-	else if (command == "FactoryReset")
+	case commandHash("FactoryReset"):
 	{
 		this->settingsManager->FactoryReset();
 		message = "Device will restart shortly, reconnect to factory wifi settings to continue!";
 		xTaskCreate(&this->reboot, "reboot_task", 1024, this, 5, NULL);
+		break;
 	}
-	else if (command == "BootIntoRecovery")
+#if CONFIG_API_BENCHMARK
+	case commandHash("BenchmarkApi"):
+	{
+		resultData = this->benchmarkApi();
+		break;
+	}
+#endif
+	case commandHash("BootIntoRecovery"):
 	{
 		message = this->bootIntoRecovery();
 
@@ -663,51 +3390,58 @@ string BottleFiller::processCommand(string payLoad)
 		{
 			xTaskCreate(&this->reboot, "reboot_task", 1024, this, 5, NULL);
 		}
+		break;
 	}
 
-	json jResultPayload;
-	jResultPayload["data"] = resultData;
-	jResultPayload["success"] = success;
-
-	if (message != "")
-	{
-		jResultPayload["message"] = message;
+	default:
+		success = false;
+		message = "Unknown command";
+		break;
 	}
 
-	string resultPayload = jResultPayload.dump();
-
-	return resultPayload;
+	return resultPayload(resultData, success, message);
 }
 
 httpd_handle_t BottleFiller::startWebserver(void)
 {
 
-	httpd_uri_t indexUri;
+	httpd_uri_t indexUri = {};
 	indexUri.uri = "/";
 	indexUri.method = HTTP_GET;
 	indexUri.handler = this->indexGetHandler;
 
-	httpd_uri_t logoUri;
+	httpd_uri_t logoUri = {};
 	logoUri.uri = "/logo.svg";
 	logoUri.method = HTTP_GET;
 	logoUri.handler = this->logoGetHandler;
 
-	httpd_uri_t manifestUri;
+	httpd_uri_t manifestUri = {};
 	manifestUri.uri = "/manifest.json";
 	manifestUri.method = HTTP_GET;
 	manifestUri.handler = this->manifestGetHandler;
 
-	httpd_uri_t postUri;
+	httpd_uri_t postUri = {};
 	postUri.uri = "/api";
 	postUri.method = HTTP_POST;
 	postUri.handler = this->apiPostHandler;
 
-	httpd_uri_t optionsUri;
+	httpd_uri_t optionsUri = {};
 	optionsUri.uri = "/api";
 	optionsUri.method = HTTP_OPTIONS;
 	optionsUri.handler = this->apiOptionsHandler;
 
-	httpd_uri_t otherUri;
+	httpd_uri_t wsUri = {};
+	wsUri.uri = "/ws";
+	wsUri.method = HTTP_GET;
+	wsUri.handler = this->wsHandler;
+	wsUri.is_websocket = true;
+
+	httpd_uri_t eventsUri = {};
+	eventsUri.uri = "/events";
+	eventsUri.method = HTTP_GET;
+	eventsUri.handler = this->eventsGetHandler;
+
+	httpd_uri_t otherUri = {};
 	otherUri.uri = "/*";
 	otherUri.method = HTTP_GET;
 	otherUri.handler = this->otherGetHandler;
@@ -717,6 +3451,7 @@ httpd_handle_t BottleFiller::startWebserver(void)
 	// whiout this the esp crashed whitout a proper warning
 	config.stack_size = 20480;
 	config.uri_match_fn = httpd_uri_match_wildcard;
+	config.max_uri_handlers = 12;
 
 	// Start the httpd server
 	ESP_LOGI(TAG, "Starting server on port: '%d'", config.server_port);
@@ -726,6 +3461,8 @@ httpd_handle_t BottleFiller::startWebserver(void)
 		httpd_register_uri_handler(server, &indexUri);
 		httpd_register_uri_handler(server, &logoUri);
 		httpd_register_uri_handler(server, &manifestUri);
+		httpd_register_uri_handler(server, &wsUri); // before the wildcard, it would catch /ws too
+		httpd_register_uri_handler(server, &eventsUri);
 		httpd_register_uri_handler(server, &otherUri);
 		httpd_register_uri_handler(server, &postUri);
 		httpd_register_uri_handler(server, &optionsUri);
@@ -787,38 +3524,63 @@ esp_err_t BottleFiller::otherGetHandler(httpd_req_t *req)
 	return ESP_OK;
 }
 
+// the body is parsed while it is received, peak memory is one chunk plus what the command keeps as json
 esp_err_t BottleFiller::apiPostHandler(httpd_req_t *req)
 {
-	string stringBuffer;
-	char buf[256];
-	uint32_t ret;
-	uint32_t remaining = req->content_len;
+	if (req->content_len > CONFIG_API_MAX_BODY_SIZE)
+	{
+		ESP_LOGW(TAG, "Api request too large %d", req->content_len);
+
+		// nothing was read, the connection has to go
+		httpd_resp_set_status(req, "413 Content Too Large");
+		httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+		httpd_resp_sendstr(req, resultPayload(nullptr, false, "Request too large").c_str());
+		return ESP_FAIL;
+	}
+
+	RequestBodyReader body(req);
+
+	ApiRequest request;
+	ApiRequestParser parser(request, &BottleFiller::commandNeedsData);
+
+	bool parsed = json::sax_parse(body.Begin(), body.End(), &parser) && parser.Complete();
 
-	while (remaining > 0)
+	// a parse error stops early, the rest must be read before we can answer
+	body.Drain();
+
+	if (body.Failed())
 	{
-		// Read the data
-		int nBytes = (std::min<uint32_t>)(remaining, sizeof(buf));
+		return ESP_FAIL;
+	}
 
-		if ((ret = httpd_req_recv(req, buf, nBytes)) <= 0)
-		{
-			if (ret == HTTPD_SOCK_ERR_TIMEOUT)
-			{
-				// Timeout, just continue
-				continue;
-			}
+	CachedCommand cached;
 
-			return ESP_FAIL;
-		}
+	if (parsed && commandCached(request.CommandHash, cached) && commandKnown(apiCommands, request))
+	{
+		const ResponseCache::Entry *entry = mainInstance->cachedResponse(request, cached);
 
-		size_t bytes_read = ret;
+		httpd_resp_set_type(req, "text/plain");
+		httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+		httpd_resp_set_hdr(req, "Access-Control-Expose-Headers", "ETag");
+		httpd_resp_set_hdr(req, "ETag", entry->ETag);
 
-		remaining -= bytes_read;
+		char ifNoneMatch[64];
+		size_t ifNoneMatchLength = httpd_req_get_hdr_value_len(req, "If-None-Match");
 
-		// append to buffer
-		stringBuffer.append((char *)buf, bytes_read);
+		if (ifNoneMatchLength > 0 && ifNoneMatchLength < sizeof(ifNoneMatch) &&
+			httpd_req_get_hdr_value_str(req, "If-None-Match", ifNoneMatch, sizeof(ifNoneMatch)) == ESP_OK &&
+			ResponseCache::Matches(*entry, ifNoneMatch))
+		{
+			httpd_resp_set_status(req, "304 Not Modified");
+			httpd_resp_send(req, NULL, 0);
+			return ESP_OK;
+		}
+
+		httpd_resp_send(req, entry->Payload.c_str(), entry->Payload.length());
+		return ESP_OK;
 	}
 
-	string commandResult = mainInstance->processCommand(stringBuffer);
+	string commandResult = parsed ? mainInstance->runCommand(request) : resultPayload(nullptr, false, "Invalid request");
 
 	const char *returnBuf = commandResult.c_str();
 	httpd_resp_set_type(req, "text/plain");
@@ -828,6 +3590,77 @@ esp_err_t BottleFiller::apiPostHandler(httpd_req_t *req)
 	return ESP_OK;
 }
 
+// long lived stream, the request is handed to the event task so this worker is free again at once
+esp_err_t BottleFiller::eventsGetHandler(httpd_req_t *req)
+{
+	httpd_req_t *asyncReq = nullptr;
+
+	if (httpd_req_async_handler_begin(req, &asyncReq) != ESP_OK)
+	{
+		return ESP_FAIL;
+	}
+
+	httpd_resp_set_type(asyncReq, "text/event-stream");
+	httpd_resp_set_hdr(asyncReq, "Cache-Control", "no-cache");
+	httpd_resp_set_hdr(asyncReq, "Access-Control-Allow-Origin", "*");
+
+	// the headers go out with the first chunk, the retry time is used when we end the stream
+	if (httpd_resp_send_chunk(asyncReq, "retry: 2000\n\n", HTTPD_RESP_USE_STRLEN) != ESP_OK)
+	{
+		httpd_req_async_handler_complete(asyncReq);
+		return ESP_OK;
+	}
+
+	if (!mainInstance->eventStream.Add(asyncReq))
+	{
+		ESP_LOGW(TAG, "Too many event clients");
+		httpd_resp_send_chunk(asyncReq, NULL, 0);
+		httpd_req_async_handler_complete(asyncReq);
+	}
+
+	return ESP_OK;
+}
+
+// status push only, frames from the client are read and dropped
+esp_err_t BottleFiller::wsHandler(httpd_req_t *req)
+{
+	if (req->method == HTTP_GET)
+	{
+		// handshake done, the new client gets the current status right away
+		mainInstance->statusForce = true;
+
+		if (mainInstance->statusTask != NULL)
+		{
+			xTaskNotifyGive(mainInstance->statusTask);
+		}
+
+		return ESP_OK;
+	}
+
+	httpd_ws_frame_t wsFrame = {};
+
+	esp_err_t ret = httpd_ws_recv_frame(req, &wsFrame, 0);
+	if (ret != ESP_OK)
+	{
+		return ret;
+	}
+
+	uint8_t buf[128];
+
+	if (wsFrame.len > sizeof(buf))
+	{
+		return ESP_FAIL;
+	}
+
+	if (wsFrame.len > 0)
+	{
+		wsFrame.payload = buf;
+		return httpd_ws_recv_frame(req, &wsFrame, wsFrame.len);
+	}
+
+	return ESP_OK;
+}
+
 // needed for cors
 esp_err_t BottleFiller::apiOptionsHandler(httpd_req_t *req)
 {
@@ -837,7 +3670,7 @@ esp_err_t BottleFiller::apiOptionsHandler(httpd_req_t *req)
 	httpd_resp_set_type(req, "text/plain");
 	httpd_resp_set_hdr(req, "Access-Control-Max-Age", "1728000");
 	httpd_resp_set_hdr(req, "Access-Control-Allow-Methods", "GET, POST, PUT, DELETE, PATCH, OPTIONS");
-	httpd_resp_set_hdr(req, "Access-Control-Allow-Headers", "Authorization,Content-Type,Accept,Origin,User-Agent,DNT,Cache-Control,X-Mx-ReqToken,Keep-Alive,X-Requested-With,If-Modified-Since");
+	httpd_resp_set_hdr(req, "Access-Control-Allow-Headers", "Authorization,Content-Type,Accept,Origin,User-Agent,DNT,Cache-Control,X-Mx-ReqToken,Keep-Alive,X-Requested-With,If-Modified-Since,If-None-Match");
 	httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
 	httpd_resp_set_status(req, "204");
 	httpd_resp_sendstr(req, returnBuf);
@@ -8,13 +8,16 @@
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/queue.h"
 #include "freertos/event_groups.h"
 
 #include "esp_log.h"
 #include <esp_http_server.h>
 #include "esp_ota_ops.h"
+#include "esp_timer.h"
 #include "driver/gpio.h"
 #include "driver/ledc.h"
+#include "soc/soc_caps.h"
 
 #include <iostream>
 #include <string>
@@ -25,10 +28,21 @@
 #include <ranges>
 #include <map>
 #include <vector>
+#include <queue>
+#include <array>
 
 #include "settings-manager.h"
 #include "filler-config.h"
+#include "filler-table.h"
 #include "input.h"
+#include "fill-command.h"
+#include "ring-buffer.h"
+#include "ledc-allocator.h"
+#include "status-snapshot.h"
+#include "event-stream.h"
+#include "api-request.h"
+#include "request-body.h"
+#include "response-cache.h"
 
 #include "nlohmann_json.hpp"
 
@@ -41,31 +55,110 @@ using json = nlohmann::json;
 class BottleFiller
 {
 private:
-    static void startAutoFill(void *arg);
+    static void fillScheduler(void *arg);
+    static void schedulerTimerCallback(void *arg);
+    static bool flowTargetReached(uint8_t fillerId, void *arg);
+    static void scaleLoop(void *arg);
     static void reboot(void *arg);
     static void factoryReset(void *arg);
 
     void startManualFill(uint8_t fillerId);
-    void startManualFill(uint8_t fillerId, uint32_t time);
+    uint32_t startManualFill(uint8_t fillerId, uint32_t time);
+    void abortFill(uint8_t fillerId, uint32_t handle);
+    json getManualFillJson(uint8_t fillerId, uint32_t handle);
     void stopManualFill(uint8_t fillerId);
 
     static void interruptLoop(void *arg);
+    static void inputIsr(void *arg);
+    void handleInputChange(Input &input, uint8_t level, int64_t timestamp);
+    PressType classifyPress(Input &input, int64_t pressTime);
+    void handleGesture(Input &input, PressType pressType, int64_t timestamp);
+    void runButtonAction(uint8_t fillerId, ButtonAction action);
+    json getInputStatsJson();
+    void clearInputs();
 
     void readSystemSettings();
     void savePIDSettings();
-    void saveSystemSettingsJson(json config);
+    bool saveSystemSettingsJson(json config);
     void start(uint8_t fillerId);
+    void postFillCommand(FillCommandType type, uint8_t fillerId);
+    void postGangFill(uint32_t fillerMask);
+    void handleFillCommand(const FillCommand &command);
+    void swapConfig(FillerConfig *filler);
+    void startTimedFill(FillerConfig *filler, uint16_t duty, uint32_t time, const FillCommand &command);
+    FillRun buildFillRun(FillerConfig *filler);
+    void startFill(FillerConfig *filler, const FillRun &run, const FillCommand &command);
+    void startGangFill(const FillCommand &command);
+    void armFill(FillerConfig *filler, const FillRun &run, int64_t startedAt);
+    void requestStart(FillerConfig *filler, const FillCommand &command);
+    void startByType(FillerConfig *filler, FillCommandType type, const FillCommand &command);
+    uint8_t getRunningPumps();
+    bool pumpSlotFree(int64_t now);
+    void startPending();
+    json getSchedulerStatusJson();
+    void publishStatus();
+    int64_t getFillEndsAt(FillerConfig *filler);
+    json getStatusJson();
+    static void statusPushLoop(void *arg);
+    static void statusBroadcast(void *arg);
+    void publishEvent(const FillEvent &event);
+    static void eventPushLoop(void *arg);
+    static int formatEvent(const FillEvent &event, char *buf, size_t size);
+    void handleFlowReached(FillerConfig *filler);
+    void handleWeightReached(FillerConfig *filler);
+    void finishFill(FillerConfig *filler, bool aborted);
+    void countFill(FillerConfig *filler, bool aborted);
+    void handleBottlePlaced(FillerConfig *filler);
+    void handleBottleRemoved(FillerConfig *filler);
+    void startCycle(FillerConfig *filler);
+    void handleDeadlines();
+    void watchPump(FillerConfig *filler, int64_t now);
+    void checkPumps(int64_t now);
+    bool checkPump(FillerConfig *filler, int64_t now);
+    int64_t getMaxPumpTime(FillerConfig *filler);
+    void pushStageDeadline(FillerConfig *filler, int64_t stageStart);
+    void pushSettleDeadline(FillerConfig *filler);
+    void learnOvershoot(FillerConfig *filler, int64_t now);
+    void scheduleStatsFlush(int64_t now);
+    void flushStats(int64_t now);
+    void readOvershoot();
+    void saveOvershoot();
+    void readCounters();
+    void saveCounters();
+    json getCountersJson();
+    json getFillerStatsJson();
+    void armSchedulerTimer();
+    void setPumpDuty(FillerConfig *filler, uint32_t duty);
+    void rampPumpDuty(FillerConfig *filler, uint32_t duty, uint32_t fadeTime);
+    void buildDutyTable();
+    void updateFillerDuty(FillerConfig *filler);
 
     string bootIntoRecovery();
 
-    string processCommand(string payLoad);
+    string runCommand(ApiRequest &request);
+    static bool commandNeedsData(uint32_t hash);
+    static bool commandNeedsId(uint32_t hash);
+    static bool commandCached(uint32_t hash, CachedCommand &command);
+    const ResponseCache::Entry *cachedResponse(ApiRequest &request, CachedCommand command);
+    static string resultPayload(const json &data, bool success, const string &message);
+#if CONFIG_API_BENCHMARK
+    json benchmarkApi();
+#endif
 
     void readFillerSettings();
-    void saveFillerSettings(json jFillers);
+    bool saveFillerSettings(json jFillers);
     void setFillerSettings(json jFillers);
     void addDefaultFillers();
+    void postReload(uint8_t fillerId, FillerConfig *filler);
+    void reloadFiller(const FillCommand &command);
+    void applyPendingConfigs();
     void initFillers();
+    esp_err_t initFillerHardware(FillerConfig *filler);
+    void releaseFillerHardware(FillerConfig *filler);
+    vector<Input> buildInputs(const vector<FillerConfig *> &fillers);
+    void addInput(vector<Input> &inputs, FillerConfig *filler, InputFunction function, gpio_num_t gpio);
     void initInputs();
+    bool stopInputs();
 
     httpd_handle_t startWebserver(void);
     void stopWebserver(httpd_handle_t server);
@@ -75,16 +168,71 @@ private:
     static esp_err_t otherGetHandler(httpd_req_t *req);
     static esp_err_t apiPostHandler(httpd_req_t *req);
     static esp_err_t apiOptionsHandler(httpd_req_t *req);
+    static esp_err_t wsHandler(httpd_req_t *req);
+    static esp_err_t eventsGetHandler(httpd_req_t *req);
 
     // small helpers
     static string to_iso_8601(std::chrono::time_point<std::chrono::system_clock> t);
 
-    std::map<uint8_t, FillerConfig *> fillers; // we support up to 6 fillers
+    FillerTable fillers; // up to MAX_FILLERS, one pwm channel each
+    LedcAllocator ledcAllocator;
+    std::array<FillerConfig *, MAX_FILLERS> pendingConfigs = {}; // saved settings waiting for an idle filler
+    uint32_t pendingRemovals = 0;                                 // bit per slot
     vector<Input> inputs;
+    RingBuffer<InputEdge, 64> inputEdges; // filled from the gpio isr
+    TaskHandle_t inputTask = NULL;
+    uint32_t droppedEdges = 0;
 
     SettingsManager *settingsManager;
     httpd_handle_t server;
 
+    // fill scheduler
+    QueueHandle_t fillQueue;
+    esp_timer_handle_t schedulerTimer;
+    std::priority_queue<FillDeadline, std::vector<FillDeadline>, std::greater<FillDeadline>> deadlines;
+    int64_t lastStartLatency = 0; // in us, command queued to pwm on
+    int64_t maxStartLatency = 0;
+
+    // staggered starts, a min heap on the array, fill scheduler only, the web task reads the status snapshot
+    // stale entries of aborted waits stay until they reach the top, so there is room for two per filler
+    uint8_t maxConcurrentPumps = 0; // 0 is no limit
+    uint16_t staggerTime = 0;       // in ms, min time between two pump starts
+    std::array<PendingStart, MAX_FILLERS * 2> pendingStarts;
+    uint8_t pendingCount = 0;
+    int64_t lastPumpStart = 0;
+    int64_t staggerWakeAt = 0;
+    int64_t lastStartWait = 0; // in us, queued to started
+    int64_t maxStartWait = 0;
+    uint32_t delayedStarts = 0;
+
+    // handles of timed manual fills from the web, only the web task hands them out
+    std::atomic<uint32_t> nextFillHandle = 1;
+
+    // pump watchdog, ticks only while a pump may be on
+    bool watchdogArmed = false;
+    uint32_t watchdogTrips = 0;
+
+    // learned overshoot and counters, written to nvs in batches
+    bool statsDirty = false;
+    int64_t lastStatsFlush = 0;
+
+    // live status, published by the fill scheduler and pushed to the websocket clients
+    StatusSnapshot statusSnapshot;
+    TaskHandle_t statusTask = NULL;
+    volatile bool statusForce = false; // a new client wants a frame even when nothing changed
+
+    // server-sent events, state changes and finished fills
+    EventStream eventStream;
+    TaskHandle_t eventTask = NULL;
+    std::array<FillerStatus, MAX_FILLERS> eventStatus = {}; // last status sent per slot
+
+    // settings responses, serialized once and sent until a save drops them
+    ResponseCache responseCache;
+
+    // weight mode
+    TaskHandle_t scaleTask = NULL;
+    bool hasScales = false;
+
     // execution
     bool run = false;
     bool controlRun = false; // true when a program is running
@@ -94,7 +242,8 @@ private:
     std::vector<bool> pumpOn;
     uint8_t gpioHigh = 1;
     uint8_t gpioLow = 0;
-    uint16_t maxDuty = 8192;
+    uint16_t maxDuty = 8192;  // 13 bit, a duty of 2^13 keeps the output high
+    uint16_t speedDuty[101]; // speed in % to duty lookup
     bool invertOutputs;
 
 public:
@@ -0,0 +1,172 @@
+/*
+ * esp-bolle-filler
+ * Copyright (C) Jeroen Dekien 2024 <dekien@gmail.com>
+ *
+ */
+
+#ifndef _EVENT_STREAM_H_
+#define _EVENT_STREAM_H_
+
+#include "freertos/FreeRTOS.h"
+#include <esp_http_server.h>
+
+#include <atomic>
+#include <array>
+
+#include "filler-config.h"
+
+using namespace std;
+
+#define MAX_EVENT_CLIENTS 4
+#define EVENT_BACKLOG_SIZE 32
+
+enum FillEventType
+{
+    StateChanged = 0,
+    FillEnded = 1
+};
+
+struct FillEvent
+{
+    uint32_t Seq; // set by the stream, lets a client see what it missed
+    FillEventType Type;
+    uint8_t FillerId;
+    FillerStatus Status;
+    FillerStatus PreviousStatus; // StateChanged only
+    int64_t At;                  // in us, esp_timer time
+    uint32_t Duration;           // FillEnded only, in ms
+    uint32_t Volume;             // FillEnded only, in ml or g, 0 in time mode
+    bool Aborted;                // FillEnded only
+    bool Manual;                 // FillEnded only
+};
+
+// Events of one client, when it can't keep up the oldest are dropped so the fill scheduler never waits.
+class EventBacklog
+{
+private:
+    std::array<FillEvent, EVENT_BACKLOG_SIZE> items;
+    uint8_t head = 0; // next to pop
+    uint8_t count = 0;
+    uint32_t dropped = 0;
+    portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+
+public:
+    void Push(const FillEvent &event)
+    {
+        portENTER_CRITICAL(&this->lock);
+        if (this->count == this->items.size())
+        {
+            this->head = (this->head + 1) % this->items.size();
+            this->count--;
+            this->dropped++;
+        }
+
+        this->items[(this->head + this->count) % this->items.size()] = event;
+        this->count++;
+        portEXIT_CRITICAL(&this->lock);
+    };
+
+    bool Pop(FillEvent &event)
+    {
+        bool popped = false;
+
+        portENTER_CRITICAL(&this->lock);
+        if (this->count > 0)
+        {
+            event = this->items[this->head];
+            this->head = (this->head + 1) % this->items.size();
+            this->count--;
+            popped = true;
+        }
+        portEXIT_CRITICAL(&this->lock);
+
+        return popped;
+    };
+
+    // returns the events dropped since the last call
+    uint32_t TakeDropped()
+    {
+        portENTER_CRITICAL(&this->lock);
+        uint32_t dropped = this->dropped;
+        this->dropped = 0;
+        portEXIT_CRITICAL(&this->lock);
+
+        return dropped;
+    };
+
+    void Clear()
+    {
+        portENTER_CRITICAL(&this->lock);
+        this->head = 0;
+        this->count = 0;
+        this->dropped = 0;
+        portEXIT_CRITICAL(&this->lock);
+    };
+};
+
+// Fixed set of server-sent event clients, each an async httpd request so no httpd worker waits on it.
+// The fill scheduler publishes, the event task sends, the httpd task adds clients.
+class EventStream
+{
+public:
+    struct Client
+    {
+        std::atomic<bool> Active = false;
+        httpd_req_t *Request = nullptr; // async copy, only touched by the task that sends
+        EventBacklog Backlog;
+    };
+
+    std::array<Client, MAX_EVENT_CLIENTS> Clients;
+
+    // httpd task only, returns false when every slot is taken
+    bool Add(httpd_req_t *request)
+    {
+        for (Client &client : this->Clients)
+        {
+            // Remove clears the request last, so a slot that is still being released is skipped
+            if (client.Active.load() || client.Request != nullptr)
+            {
+                continue;
+            }
+
+            client.Backlog.Clear();
+            client.Request = request;
+            client.Active = true;
+
+            return true;
+        }
+
+        return false;
+    };
+
+    // the caller completes the async request
+    void Remove(Client &client)
+    {
+        client.Active = false;
+        client.Request = nullptr;
+    };
+
+    // single producer, the fill scheduler task, returns true when a client got it
+    bool Publish(FillEvent event)
+    {
+        bool delivered = false;
+
+        event.Seq = this->seq++;
+
+        for (Client &client : this->Clients)
+        {
+            if (client.Active.load())
+            {
+                client.Backlog.Push(event);
+                delivered = true;
+            }
+        }
+
+        return delivered;
+    };
+
+private:
+    uint32_t seq = 0;
+};
+
+#endif // _EVENT_STREAM_H_
@@ -0,0 +1,93 @@
+/*
+ * esp-bolle-filler
+ * Copyright (C) Jeroen Dekien 2024 <dekien@gmail.com>
+ *
+ */
+
+#ifndef _FILL_COMMAND_H_
+#define _FILL_COMMAND_H_
+
+#include <iostream>
+
+using namespace std;
+
+class FillerConfig;
+
+enum FillCommandType
+{
+    StartFill = 0,   // start when idle, abort when filling
+    AbortFill = 1,   // stop at once
+    StartManual = 2, // run until StopManual
+    StopManual = 3,
+    DeadlineWake = 4,  // posted by the scheduler timer, no filler
+    PrimeFill = 5,     // timed run at manual speed to prime/purge the line
+    TopUpFill = 6,     // short timed run at auto speed
+    FlowReached = 7,   // posted from the flow meter isr
+    WeightReached = 8, // posted from the scale task
+    ResetOvershoot = 9, // forget the learned overshoot of a filler
+    GangFill = 10,      // start all fillers in FillerMask together
+    SwapConfig = 11,    // publish Config, a changed copy of the filler settings
+    ReloadConfig = 12,  // saved settings, Config replaces the filler or removes it when null
+    ResetBatch = 13,    // start counting the batch from 0
+    ResetCounters = 14, // clear all counters of a filler
+    BottlePlaced = 15,  // bottle sensor, starts a fill after the settle time when the cycle is armed
+    BottleRemoved = 16  // bottle sensor, re-arms the cycle and aborts a fill that is still running
+};
+
+// commands are posted to the fill scheduler task over a queue, keep this small and trivially copyable
+struct FillCommand
+{
+    FillCommandType Type;
+    uint8_t FillerId;
+    uint32_t FillerMask;  // GangFill only, bit n set for filler id n
+    FillerConfig *Config; // SwapConfig only, the scheduler takes ownership
+    uint32_t Handle;      // StartManual and AbortFill from the web, 0 for buttons
+    uint32_t Time;        // StartManual only, in ms, 0 runs until StopManual
+    int64_t QueuedAt;     // in us, used to measure start latency
+};
+
+enum FillDeadlineType
+{
+    StageEnd = 0,   // end of a time stage, or the time limit in flow/weight mode
+    Settle = 1,     // measure the overshoot once the last drops are in
+    Flush = 2,      // write learned values to nvs, no filler
+    Stagger = 3,    // next pending start may go, no filler
+    Reload = 4,     // retry pending config changes, no filler
+    CycleStart = 5, // bottle settled, Generation is the bottle token
+    Watchdog = 6,   // periodic pump safety check while a pump may be on, no filler
+    ManualEnd = 7   // end of a timed manual fill
+};
+
+// entry in the deadline min heap, a stale generation means the fill was aborted or replaced
+struct FillDeadline
+{
+    int64_t At; // in us
+    FillDeadlineType Type;
+    uint8_t FillerId;
+    uint32_t Generation;
+
+    bool operator>(const FillDeadline &other) const
+    {
+        return At > other.At;
+    }
+};
+
+// start waiting for a free pump slot, oldest first
+struct PendingStart
+{
+    int64_t QueuedAt; // in us
+    FillCommandType Type;
+    uint8_t FillerId;
+    uint32_t Generation;
+
+    bool operator>(const PendingStart &other) const
+    {
+        if (QueuedAt == other.QueuedAt)
+        {
+            return FillerId > other.FillerId;
+        }
+        return QueuedAt > other.QueuedAt;
+    }
+};
+
+#endif // _FILL_COMMAND_H_
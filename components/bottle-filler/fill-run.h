@@ -0,0 +1,124 @@
+/*
+ * esp-bolle-filler
+ * Copyright (C) Jeroen Dekien 2024 <dekien@gmail.com>
+ *
+ */
+
+#ifndef _FILL_RUN_H_
+#define _FILL_RUN_H_
+
+#include <cstdint>
+#include <algorithm>
+
+#include "overshoot-estimator.h"
+
+using namespace std;
+
+// what ends an auto fill
+enum FillMode
+{
+    TimeMode = 0,
+    FlowMode = 1,  // needs a flow meter, fillTime becomes a time limit
+    WeightMode = 2 // needs a load cell, fillTime becomes a time limit
+};
+
+#define MAX_FILL_STAGES 4
+
+// one step of a fill profile, stored as [amount, speed] to keep the msgpack blob small
+struct FillStage
+{
+    uint32_t Amount; // in ms in time mode, in ml in flow mode, in g in weight mode
+    uint8_t Speed;   // 0 to 100%
+    uint16_t Duty;   // runtime only, from the duty lookup table
+};
+
+// the stages of the fill that is running, copied at start so setting changes don't affect it
+// no hardware in here, so the stage targets can be checked on the host
+struct FillRun
+{
+    FillMode Mode;
+    bool Auto; // a bottle fill, prime and top up runs are not counted
+    FillStage Stages[MAX_FILL_STAGES];
+    uint8_t StageCount;
+    uint8_t Stage;
+    int32_t Compensation; // taken off the last stage, in the unit of the estimator of the mode
+    int32_t CutoffValue;  // pulses or mg when the pump was stopped
+
+    bool LastStage() const
+    {
+        return this->Stage + 1 == this->StageCount;
+    };
+
+    // flow mode pulses of the current stage, the last one stops early for what is still in the hose
+    uint32_t StagePulses(uint32_t pulsesPerLiter) const
+    {
+        int64_t pulses = ((uint64_t)this->Stages[this->Stage].Amount * pulsesPerLiter) / 1000;
+
+        if (this->LastStage())
+        {
+            pulses -= this->Compensation;
+        }
+
+        return (uint32_t)std::max<int64_t>(pulses, 1);
+    };
+
+    // time mode end of the current stage in us, the last one is moved forward by the learned timer latency
+    int64_t StageEndsAt(int64_t stageStart) const
+    {
+        int64_t at = stageStart + ((int64_t)this->Stages[this->Stage].Amount * 1000);
+
+        if (this->LastStage())
+        {
+            at = std::max(at - this->Compensation, stageStart);
+        }
+
+        return at;
+    };
+
+    // weight mode target of the current stage in g, the stages add up and the last one stops early for what is still in the air
+    float StageWeight() const
+    {
+        float target = 0;
+        for (uint8_t i = 0; i <= this->Stage; i++)
+        {
+            target += this->Stages[i].Amount;
+        }
+
+        if (this->LastStage())
+        {
+            target -= this->Compensation / 1000.0f;
+        }
+
+        return target;
+    };
+
+    // time mode end of the whole fill in us, 0 when a sensor ends it
+    int64_t EndsAt(int64_t startedAt) const
+    {
+        if (this->Mode != TimeMode)
+        {
+            return 0;
+        }
+
+        int64_t endsAt = startedAt;
+        for (uint8_t i = 0; i < this->StageCount; i++)
+        {
+            endsAt += (int64_t)this->Stages[i].Amount * 1000;
+        }
+
+        return endsAt;
+    };
+};
+
+// what the last stage is cut short by, a weight fill uses the configured in flight weight until it learned one
+inline int32_t fillCompensation(FillMode mode, const OvershootEstimator &estimator, float inFlightWeight)
+{
+    if (mode == WeightMode && estimator.Samples == 0)
+    {
+        return (int32_t)(inFlightWeight * 1000);
+    }
+
+    return estimator.Get();
+}
+
+#endif // _FILL_RUN_H_
@@ -1,8 +1,16 @@
 #ifndef _FillerConfig_H_
 #define _FillerConfig_H_
 
+#include "flow-meter.h"
+#include "hx711.h"
+#include "ledc-allocator.h"
+#include "overshoot-estimator.h"
+#include "fill-run.h"
+
 #include "nlohmann_json.hpp"
 
+#include <atomic>
+
 using namespace std;
 using json = nlohmann::json;
 
@@ -10,7 +18,29 @@ enum FillerStatus
 {
     Idle = 0,
     Filling = 1,
-    Aborting = 2
+    Aborting = 2,
+    ManualFilling = 3,
+    Waiting = 4 // start is queued until a pump slot is free
+};
+
+// what a button gesture on the auto input does
+enum ButtonAction
+{
+    ActionNone = 0,
+    ActionStart = 1, // start when idle, abort when filling
+    ActionAbort = 2,
+    ActionPrime = 3,
+    ActionTopUp = 4
+};
+
+// production counters, kept in ram by the fill scheduler and written to nvs in batches
+struct FillCounters
+{
+    uint32_t Completed;
+    uint32_t Aborted;
+    uint32_t BatchCount; // completed since the last batch reset
+    uint64_t PumpOnTime; // in ms, manual fills included
+    uint64_t Volume;     // in ml, flow and weight mode only
 };
 
 class FillerConfig
@@ -21,11 +51,137 @@ public:
     gpio_num_t pumpPin;
     gpio_num_t autoPin;
     gpio_num_t manualPin;
-    uint8_t channel;
+    LedcChannel pwm = {LEDC_LOW_SPEED_MODE, LEDC_CHANNEL_MAX, LEDC_TIMER_0}; // assigned in initFillers
     uint8_t autoFillSpeed;   // 0 to 100%
     uint8_t manualFillSpeed; // 0 to 100%
     uint32_t fillTime;       // in ms
-    FillerStatus status;
+    std::atomic<FillerStatus> status = Idle; // written by the fill scheduler, read from every task
+
+    // added later, defaults are used when older configs don't have them
+    uint16_t debounceTime = 20;     // in ms, for the auto and manual inputs
+    uint16_t minPressTime = 50;     // in ms, shorter presses are ignored
+    uint16_t longPressTime = 1000;  // in ms
+    uint16_t doublePressTime = 400; // in ms, max time between 2 short presses
+
+    ButtonAction shortPressAction = ActionStart;
+    ButtonAction longPressAction = ActionNone;
+    ButtonAction doublePressAction = ActionNone;
+    uint32_t primeTime = 2000; // in ms
+    uint32_t topUpTime = 500;  // in ms
+
+    uint16_t rampUpTime = 0;   // in ms, soft start, included in the fill time
+    uint16_t rampDownTime = 0; // in ms, soft stop, starts when the fill time has passed
+
+    FillMode fillMode = TimeMode;
+    gpio_num_t flowPin = (gpio_num_t)0;
+    uint32_t pulsesPerLiter = 450;
+    uint32_t targetVolume = 0; // in ml, flow mode without stages
+
+    gpio_num_t scaleDataPin = (gpio_num_t)0;
+    gpio_num_t scaleClockPin = (gpio_num_t)0;
+    float scaleFactor = 420.0;  // raw counts per gram
+    uint32_t targetWeight = 0;  // in g, weight mode without stages
+    float inFlightWeight = 0.0; // in g, still falling into the bottle when the pump stops
+
+    // optional auto fill profile, when set it replaces autoFillSpeed and fillTime/targetVolume
+    FillStage stages[MAX_FILL_STAGES] = {};
+    uint8_t stageCount = 0;
+
+    uint32_t batchTarget = 0; // auto fills stop after this many bottles, 0 is no limit
+
+    // auto cycle, a fill starts when a bottle is placed and the next one only after it was removed
+    gpio_num_t bottlePin = (gpio_num_t)0; // 0 is no sensor
+    uint16_t settleTime = 500;            // in ms, bottle must stay in place this long
+
+    // pump watchdog, auto fills are limited by their own fill time
+    uint32_t maxManualTime = 60000; // in ms, longest manual run, 0 is no limit
+    uint16_t noFlowTime = 3000;     // in ms, abort when the flow meter sees no pulse this long, 0 is off
+
+    // runtime only, duty for the speeds above, filled from the lookup table
+    uint16_t autoDuty = 0;
+    uint16_t manualDuty = 0;
+
+    // runtime only, owned by the fill scheduler task
+    int64_t startedAt = 0;   // in us, esp_timer time at fill start
+    uint32_t generation = 0; // bumped on every start/abort to invalidate pending deadlines
+    FillRun run = {};
+    FlowMeter *flowMeter = nullptr;
+    HX711 *scale = nullptr;
+    bool ownsSensors = true;             // false once a newer config took the sensors over
+    int32_t tareValue = 0;               // raw scale value at fill start
+    volatile bool weightReached = false; // set by the scale task, cleared by the scheduler
+
+    // learned per fill mode: us late in time mode, pulses in flow mode, mg in weight mode
+    OvershootEstimator overshoot[3];
+
+    FillCounters counters = {};
+
+    // auto cycle state, owned by the fill scheduler
+    bool bottlePresent = false;
+    bool cycleArmed = false;  // set when the bottle sensor reports an empty place
+    uint32_t bottleToken = 0; // bumped on every sensor change, invalidates a pending cycle start
+
+    // web handle of the current or last manual fill, so a client can poll or abort exactly that fill
+    uint32_t fillHandle = 0;
+    uint32_t refusedHandle = 0; // last handle that could not start
+    int64_t manualEndsAt = 0;   // in us, 0 runs until release
+    bool lastFillAborted = false;
+
+    // watchdog state, owned by the fill scheduler
+    bool watched = false;    // pump started and not yet seen off
+    int64_t stoppedAt = 0;   // in us, when the pump was told to stop
+    uint32_t flowPulses = 0; // meter count at the last check
+    int64_t flowSeenAt = 0;  // in us, last time the count moved
+
+    // freed by the filler table once no task can still use it, the sensors go with it unless they were handed over
+    ~FillerConfig()
+    {
+        if (this->ownsSensors)
+        {
+            delete this->flowMeter;
+            delete this->scale;
+        }
+    };
+
+    // same pins, so the channel and sensors can be handed over as they are
+    bool sameHardware(const FillerConfig *other)
+    {
+        return this->pumpPin == other->pumpPin && this->flowPin == other->flowPin &&
+               this->scaleDataPin == other->scaleDataPin && this->scaleClockPin == other->scaleClockPin;
+    };
+
+    // takes over the runtime state of the config this one replaces, scheduler task only
+    void adoptRuntime(FillerConfig *previous)
+    {
+        this->pwm = previous->pwm;
+        this->status = previous->status.load();
+        this->startedAt = previous->startedAt;
+        this->generation = previous->generation;
+        this->run = previous->run;
+        this->flowMeter = previous->flowMeter;
+        this->scale = previous->scale;
+        this->tareValue = previous->tareValue;
+        this->weightReached = previous->weightReached;
+        std::copy(previous->overshoot, previous->overshoot + 3, this->overshoot);
+        this->counters = previous->counters;
+        this->adoptCycle(previous);
+        this->fillHandle = previous->fillHandle;
+        this->refusedHandle = previous->refusedHandle;
+        this->manualEndsAt = previous->manualEndsAt;
+        this->lastFillAborted = previous->lastFillAborted;
+        this->watched = previous->watched;
+        this->stoppedAt = previous->stoppedAt;
+        this->flowPulses = previous->flowPulses;
+        this->flowSeenAt = previous->flowSeenAt;
+        previous->ownsSensors = false;
+    };
+
+    void adoptCycle(const FillerConfig *previous)
+    {
+        this->bottlePresent = previous->bottlePresent;
+        this->cycleArmed = previous->cycleArmed;
+        this->bottleToken = previous->bottleToken;
+    };
 
     json to_json()
     {
@@ -38,6 +194,32 @@ public:
         jFillerConfig["autoFillSpeed"] = this->autoFillSpeed;
         jFillerConfig["manualFillSpeed"] = this->manualFillSpeed;
         jFillerConfig["fillTime"] = this->fillTime;
+        jFillerConfig["debounceTime"] = this->debounceTime;
+        jFillerConfig["minPressTime"] = this->minPressTime;
+        jFillerConfig["longPressTime"] = this->longPressTime;
+        jFillerConfig["doublePressTime"] = this->doublePressTime;
+        jFillerConfig["shortPressAction"] = this->shortPressAction;
+        jFillerConfig["longPressAction"] = this->longPressAction;
+        jFillerConfig["doublePressAction"] = this->doublePressAction;
+        jFillerConfig["primeTime"] = this->primeTime;
+        jFillerConfig["topUpTime"] = this->topUpTime;
+        jFillerConfig["rampUpTime"] = this->rampUpTime;
+        jFillerConfig["rampDownTime"] = this->rampDownTime;
+        jFillerConfig["fillMode"] = this->fillMode;
+        jFillerConfig["flowPin"] = this->flowPin;
+        jFillerConfig["pulsesPerLiter"] = this->pulsesPerLiter;
+        jFillerConfig["targetVolume"] = this->targetVolume;
+        jFillerConfig["scaleDataPin"] = this->scaleDataPin;
+        jFillerConfig["scaleClockPin"] = this->scaleClockPin;
+        jFillerConfig["scaleFactor"] = this->scaleFactor;
+        jFillerConfig["targetWeight"] = this->targetWeight;
+        jFillerConfig["inFlightWeight"] = this->inFlightWeight;
+        jFillerConfig["stages"] = this->stagesToJson();
+        jFillerConfig["batchTarget"] = this->batchTarget;
+        jFillerConfig["bottlePin"] = this->bottlePin;
+        jFillerConfig["settleTime"] = this->settleTime;
+        jFillerConfig["maxManualTime"] = this->maxManualTime;
+        jFillerConfig["noFlowTime"] = this->noFlowTime;
 
         return jFillerConfig;
     };
@@ -49,12 +231,221 @@ public:
         this->pumpPin = (gpio_num_t)jsonData["pumpPin"].get<uint>();
         this->autoPin = (gpio_num_t)jsonData["autoPin"].get<uint>();
         this->manualPin = (gpio_num_t)jsonData["manualPin"].get<uint>();
-        this->autoFillSpeed = jsonData["autoFillSpeed"].get<uint>();
-        this->manualFillSpeed = jsonData["manualFillSpeed"].get<uint>();
+        // clamped before narrowing, the speed indexes the duty table
+        this->autoFillSpeed = std::min<uint>(jsonData["autoFillSpeed"].get<uint>(), 100);
+        this->manualFillSpeed = std::min<uint>(jsonData["manualFillSpeed"].get<uint>(), 100);
         this->fillTime = jsonData["fillTime"].get<uint>();
+
+        // added later, only override the defaults when present
+        if (!jsonData["debounceTime"].is_null() && jsonData["debounceTime"].is_number())
+        {
+            this->debounceTime = jsonData["debounceTime"].get<uint>();
+        }
+
+        if (!jsonData["minPressTime"].is_null() && jsonData["minPressTime"].is_number())
+        {
+            this->minPressTime = jsonData["minPressTime"].get<uint>();
+        }
+
+        if (!jsonData["longPressTime"].is_null() && jsonData["longPressTime"].is_number())
+        {
+            this->longPressTime = jsonData["longPressTime"].get<uint>();
+        }
+
+        if (!jsonData["doublePressTime"].is_null() && jsonData["doublePressTime"].is_number())
+        {
+            this->doublePressTime = jsonData["doublePressTime"].get<uint>();
+        }
+
+        if (!jsonData["shortPressAction"].is_null() && jsonData["shortPressAction"].is_number())
+        {
+            this->shortPressAction = (ButtonAction)jsonData["shortPressAction"].get<uint>();
+        }
+
+        if (!jsonData["longPressAction"].is_null() && jsonData["longPressAction"].is_number())
+        {
+            this->longPressAction = (ButtonAction)jsonData["longPressAction"].get<uint>();
+        }
+
+        if (!jsonData["doublePressAction"].is_null() && jsonData["doublePressAction"].is_number())
+        {
+            this->doublePressAction = (ButtonAction)jsonData["doublePressAction"].get<uint>();
+        }
+
+        if (!jsonData["primeTime"].is_null() && jsonData["primeTime"].is_number())
+        {
+            this->primeTime = jsonData["primeTime"].get<uint>();
+        }
+
+        if (!jsonData["topUpTime"].is_null() && jsonData["topUpTime"].is_number())
+        {
+            this->topUpTime = jsonData["topUpTime"].get<uint>();
+        }
+
+        if (!jsonData["rampUpTime"].is_null() && jsonData["rampUpTime"].is_number())
+        {
+            this->rampUpTime = jsonData["rampUpTime"].get<uint>();
+        }
+
+        if (!jsonData["rampDownTime"].is_null() && jsonData["rampDownTime"].is_number())
+        {
+            this->rampDownTime = jsonData["rampDownTime"].get<uint>();
+        }
+
+        if (!jsonData["fillMode"].is_null() && jsonData["fillMode"].is_number())
+        {
+            this->fillMode = (FillMode)jsonData["fillMode"].get<uint>();
+        }
+
+        if (!jsonData["flowPin"].is_null() && jsonData["flowPin"].is_number())
+        {
+            this->flowPin = (gpio_num_t)jsonData["flowPin"].get<uint>();
+        }
+
+        if (!jsonData["pulsesPerLiter"].is_null() && jsonData["pulsesPerLiter"].is_number())
+        {
+            this->pulsesPerLiter = jsonData["pulsesPerLiter"].get<uint>();
+        }
+
+        if (!jsonData["targetVolume"].is_null() && jsonData["targetVolume"].is_number())
+        {
+            this->targetVolume = jsonData["targetVolume"].get<uint>();
+        }
+
+        if (!jsonData["scaleDataPin"].is_null() && jsonData["scaleDataPin"].is_number())
+        {
+            this->scaleDataPin = (gpio_num_t)jsonData["scaleDataPin"].get<uint>();
+        }
+
+        if (!jsonData["scaleClockPin"].is_null() && jsonData["scaleClockPin"].is_number())
+        {
+            this->scaleClockPin = (gpio_num_t)jsonData["scaleClockPin"].get<uint>();
+        }
+
+        if (!jsonData["scaleFactor"].is_null() && jsonData["scaleFactor"].is_number())
+        {
+            this->scaleFactor = jsonData["scaleFactor"].get<float>();
+        }
+
+        if (!jsonData["targetWeight"].is_null() && jsonData["targetWeight"].is_number())
+        {
+            this->targetWeight = jsonData["targetWeight"].get<uint>();
+        }
+
+        if (!jsonData["inFlightWeight"].is_null() && jsonData["inFlightWeight"].is_number())
+        {
+            this->inFlightWeight = jsonData["inFlightWeight"].get<float>();
+        }
+
+        if (jsonData["stages"].is_array())
+        {
+            this->stagesFromJson(jsonData["stages"]);
+        }
+
+        if (!jsonData["batchTarget"].is_null() && jsonData["batchTarget"].is_number())
+        {
+            this->batchTarget = jsonData["batchTarget"].get<uint>();
+        }
+
+        if (!jsonData["bottlePin"].is_null() && jsonData["bottlePin"].is_number())
+        {
+            this->bottlePin = (gpio_num_t)jsonData["bottlePin"].get<uint>();
+        }
+
+        if (!jsonData["settleTime"].is_null() && jsonData["settleTime"].is_number())
+        {
+            this->settleTime = jsonData["settleTime"].get<uint>();
+        }
+
+        if (!jsonData["maxManualTime"].is_null() && jsonData["maxManualTime"].is_number())
+        {
+            this->maxManualTime = jsonData["maxManualTime"].get<uint>();
+        }
+
+        if (!jsonData["noFlowTime"].is_null() && jsonData["noFlowTime"].is_number())
+        {
+            this->noFlowTime = jsonData["noFlowTime"].get<uint>();
+        }
+
         this->status = Idle;
     };
 
+    json stagesToJson()
+    {
+        json jStages = json::array({});
+
+        for (uint8_t i = 0; i < this->stageCount; i++)
+        {
+            jStages.push_back({this->stages[i].Amount, this->stages[i].Speed});
+        }
+
+        return jStages;
+    };
+
+    uint32_t volumeToPulses(uint32_t volume)
+    {
+        return ((uint64_t)volume * this->pulsesPerLiter) / 1000;
+    };
+
+    uint32_t pulsesToVolume(uint32_t pulses)
+    {
+        if (this->pulsesPerLiter == 0)
+        {
+            return 0;
+        }
+
+        return ((uint64_t)pulses * 1000) / this->pulsesPerLiter;
+    };
+
+    // with a bottle sensor nothing is filled into an empty place
+    bool bottleMissing()
+    {
+        return this->bottlePin > 0 && !this->bottlePresent;
+    };
+
+    bool batchComplete()
+    {
+        return this->batchTarget > 0 && this->counters.BatchCount >= this->batchTarget;
+    };
+
+    // net weight in g since the tare at fill start
+    float netWeight()
+    {
+        if (this->scale == nullptr || this->scaleFactor == 0)
+        {
+            return 0;
+        }
+
+        return (this->scale->Value - this->tareValue) / this->scaleFactor;
+    };
+
+    void stagesFromJson(json jStages)
+    {
+        this->stageCount = 0;
+
+        for (auto &el : jStages.items())
+        {
+            auto jStage = el.value();
+
+            if (this->stageCount >= MAX_FILL_STAGES)
+            {
+                break;
+            }
+
+            if (!jStage.is_array() || jStage.size() != 2 || !jStage[0].is_number() || !jStage[1].is_number())
+            {
+                continue;
+            }
+
+            FillStage &stage = this->stages[this->stageCount];
+            stage.Amount = jStage[0].get<uint>();
+            stage.Speed = std::min<uint>(jStage[1].get<uint>(), 100);
+            stage.Duty = 0;
+
+            this->stageCount++;
+        }
+    };
+
 protected:
 private:
 };
@@ -0,0 +1,219 @@
+/*
+ * esp-bolle-filler
+ * Copyright (C) Jeroen Dekien 2024 <dekien@gmail.com>
+ *
+ */
+
+#ifndef _FILLER_TABLE_H_
+#define _FILLER_TABLE_H_
+
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+
+#include <atomic>
+#include <array>
+
+#include "filler-config.h"
+
+using namespace std;
+
+// Fixed table of filler slots, slot n holds filler id n + 1, so a lookup is an index and one atomic load.
+// A changed config is published with a single atomic store (read-copy-update), readers on other tasks never block.
+// The replaced config is retired and only freed by Reclaim once no reader is inside a read section anymore.
+class FillerTable
+{
+private:
+    std::array<std::atomic<FillerConfig *>, MAX_FILLERS> slots = {};
+    std::atomic<uint32_t> readers = 0;
+    std::atomic<uint32_t> version = 0; // bumped on every publish, tells a cached copy of the table it is stale
+
+    // writers are rare, the spinlock only guards this small list, never the lookups
+    std::array<FillerConfig *, MAX_FILLERS * 2> retired = {};
+    uint8_t retiredCount = 0;
+    portMUX_TYPE retireLock = portMUX_INITIALIZER_UNLOCKED;
+
+    void retire(FillerConfig *filler)
+    {
+        if (filler == nullptr)
+        {
+            return;
+        }
+
+        bool full = false;
+
+        portENTER_CRITICAL(&this->retireLock);
+        if (this->retiredCount < this->retired.size())
+        {
+            this->retired[this->retiredCount++] = filler;
+        }
+        else
+        {
+            full = true;
+        }
+        portEXIT_CRITICAL(&this->retireLock);
+
+        if (full)
+        {
+            // a reader that never leaves, better to leak one config than to free it under its feet
+            ESP_LOGE("FillerTable", "Retire list full, filler %d leaked", filler->id);
+        }
+    };
+
+public:
+    class Iterator
+    {
+    private:
+        const FillerTable *table;
+        uint8_t index;
+        FillerConfig *current = nullptr;
+
+        // empty slots are skipped, the loaded pointer is kept so a concurrent swap can't change it mid loop
+        void skip()
+        {
+            for (; this->index < MAX_FILLERS; this->index++)
+            {
+                this->current = this->table->slots[this->index].load();
+                if (this->current != nullptr)
+                {
+                    return;
+                }
+            }
+
+            this->current = nullptr;
+        };
+
+    public:
+        Iterator(const FillerTable *table, uint8_t index) : table(table), index(index)
+        {
+            this->skip();
+        };
+
+        FillerConfig *operator*() const
+        {
+            return this->current;
+        };
+
+        Iterator &operator++()
+        {
+            this->index++;
+            this->skip();
+            return *this;
+        };
+
+        bool operator!=(const Iterator &other) const
+        {
+            return this->index != other.index;
+        };
+    };
+
+    // keeps retired configs alive while the calling task uses pointers it loaded from the table
+    class ReadGuard
+    {
+    private:
+        FillerTable &table;
+
+    public:
+        ReadGuard(FillerTable &table) : table(table)
+        {
+            this->table.readers++;
+        };
+
+        ~ReadGuard()
+        {
+            this->table.readers--;
+        };
+    };
+
+    Iterator begin() const
+    {
+        return Iterator(this, 0);
+    };
+
+    Iterator end() const
+    {
+        return Iterator(this, MAX_FILLERS);
+    };
+
+    FillerConfig *Get(uint8_t fillerId) const
+    {
+        if (fillerId == 0 || fillerId > MAX_FILLERS)
+        {
+            return nullptr;
+        }
+
+        return this->slots[fillerId - 1].load();
+    };
+
+    // publishes the filler in the slot of its id, the previous config is retired
+    void Publish(FillerConfig *filler)
+    {
+        if (filler->id == 0 || filler->id > MAX_FILLERS)
+        {
+            return;
+        }
+
+        this->retire(this->slots[filler->id - 1].exchange(filler));
+        this->version++;
+    };
+
+    void Remove(uint8_t fillerId)
+    {
+        if (fillerId == 0 || fillerId > MAX_FILLERS)
+        {
+            return;
+        }
+
+        this->retire(this->slots[fillerId - 1].exchange(nullptr));
+        this->version++;
+    };
+
+    uint32_t Version() const
+    {
+        return this->version.load();
+    };
+
+    bool HasRetired()
+    {
+        portENTER_CRITICAL(&this->retireLock);
+        bool hasRetired = this->retiredCount > 0;
+        portEXIT_CRITICAL(&this->retireLock);
+
+        return hasRetired;
+    };
+
+    bool Empty() const
+    {
+        return !(this->begin() != this->end());
+    };
+
+    // frees the retired configs when no task can still hold one, only call it from one task that doesn't hold a guard
+    void Reclaim()
+    {
+        std::array<FillerConfig *, MAX_FILLERS * 2> freeing;
+        uint8_t count = 0;
+
+        // take the list first, every reader that could have loaded one of these has entered by now
+        portENTER_CRITICAL(&this->retireLock);
+        count = this->retiredCount;
+        std::copy(this->retired.begin(), this->retired.begin() + count, freeing.begin());
+        portEXIT_CRITICAL(&this->retireLock);
+
+        if (count == 0 || this->readers.load() != 0)
+        {
+            return;
+        }
+
+        // configs retired in the meantime stay for the next round
+        portENTER_CRITICAL(&this->retireLock);
+        std::copy(this->retired.begin() + count, this->retired.begin() + this->retiredCount, this->retired.begin());
+        this->retiredCount -= count;
+        portEXIT_CRITICAL(&this->retireLock);
+
+        for (uint8_t i = 0; i < count; i++)
+        {
+            delete freeing[i];
+        }
+    };
+};
+
+#endif // _FILLER_TABLE_H_
@@ -0,0 +1,276 @@
+/*
+ * esp-bottle-filler
+ * Copyright (C) Dekien Jeroen 2024
+ */
+#include "flow-meter.h"
+
+using namespace std;
+
+static const char *TAG = "FlowMeter";
+
+FlowMeter::FlowMeter(gpio_num_t pin, uint8_t fillerId)
+{
+    this->pin = pin;
+    this->fillerId = fillerId;
+}
+
+FlowMeter::~FlowMeter()
+{
+    this->Disarm();
+
+#if SOC_PCNT_SUPPORTED
+    if (this->unit != NULL)
+    {
+        pcnt_unit_stop(this->unit);
+        pcnt_unit_disable(this->unit);
+        pcnt_del_channel(this->channel);
+        pcnt_del_unit(this->unit);
+    }
+#else
+    gpio_isr_handler_remove(this->pin);
+#endif
+}
+
+#if SOC_PCNT_SUPPORTED
+
+esp_err_t FlowMeter::Init()
+{
+    ESP_LOGI(TAG, "Flow meter on %d using pcnt", this->pin);
+
+    pcnt_unit_config_t unitConfig = {};
+    unitConfig.low_limit = -1;
+    unitConfig.high_limit = highLimit;
+
+    esp_err_t err = pcnt_new_unit(&unitConfig, &this->unit);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "No free pcnt unit for %d: %s", this->pin, esp_err_to_name(err));
+        this->unit = NULL;
+        return err;
+    }
+
+    // hall sensors are clean, this only removes spikes from the pump wiring
+    pcnt_glitch_filter_config_t filterConfig = {};
+    filterConfig.max_glitch_ns = 1000;
+    pcnt_unit_set_glitch_filter(this->unit, &filterConfig);
+
+    pcnt_chan_config_t channelConfig = {};
+    channelConfig.edge_gpio_num = this->pin;
+    channelConfig.level_gpio_num = -1;
+    ESP_ERROR_CHECK(pcnt_new_channel(this->unit, &channelConfig, &this->channel));
+    ESP_ERROR_CHECK(pcnt_channel_set_edge_action(this->channel, PCNT_CHANNEL_EDGE_ACTION_INCREASE, PCNT_CHANNEL_EDGE_ACTION_HOLD));
+
+    pcnt_event_callbacks_t callbacks = {};
+    callbacks.on_reach = &this->onReach;
+    ESP_ERROR_CHECK(pcnt_unit_register_event_callbacks(this->unit, &callbacks, this));
+
+    // the counter resets at the high limit, this watch point lets us count the overflows
+    ESP_ERROR_CHECK(pcnt_unit_add_watch_point(this->unit, highLimit));
+
+    ESP_ERROR_CHECK(pcnt_unit_enable(this->unit));
+    ESP_ERROR_CHECK(pcnt_unit_clear_count(this->unit));
+    ESP_ERROR_CHECK(pcnt_unit_start(this->unit));
+
+    return ESP_OK;
+}
+
+// a watch point only takes effect after the next clear of the count
+void FlowMeter::setTargetWatchPoint(uint32_t remaining)
+{
+    if (this->targetWatchPoint != 0)
+    {
+        pcnt_unit_remove_watch_point(this->unit, this->targetWatchPoint);
+        this->targetWatchPoint = 0;
+    }
+
+    // a target that is a multiple of the high limit is caught by the overflow watch point
+    int remainder = remaining % highLimit;
+    if (remainder != 0)
+    {
+        this->targetWatchPoint = remainder;
+        pcnt_unit_add_watch_point(this->unit, remainder);
+    }
+}
+
+void FlowMeter::Arm(uint32_t targetPulses)
+{
+    if (this->unit == NULL)
+    {
+        return;
+    }
+
+    this->armed = false;
+
+    this->setTargetWatchPoint(targetPulses);
+
+    this->target = targetPulses;
+    portENTER_CRITICAL(&this->lock);
+    pcnt_unit_clear_count(this->unit);
+    this->overflows = 0;
+    this->offset = 0;
+    portEXIT_CRITICAL(&this->lock);
+    this->armed = true;
+}
+
+bool FlowMeter::Extend(uint32_t morePulses)
+{
+    if (this->unit == NULL)
+    {
+        return false;
+    }
+
+    this->armed = false;
+    this->target = this->target + morePulses;
+
+    // the count has to be cleared for the new watch point, what was counted so far moves to the offset
+    // the watch point is set for the count read before the clear, when pulses came in between it is set again
+    for (int attempt = 0; attempt < 3; attempt++)
+    {
+        uint32_t counted = this->GetPulses();
+        if (counted >= this->target)
+        {
+            break;
+        }
+
+        this->setTargetWatchPoint(this->target - counted);
+
+        int count = 0;
+        portENTER_CRITICAL(&this->lock);
+        pcnt_unit_get_count(this->unit, &count);
+        pcnt_unit_clear_count(this->unit);
+        this->offset = this->offset + (this->overflows * highLimit) + count;
+        this->overflows = 0;
+        portEXIT_CRITICAL(&this->lock);
+
+        if (this->offset == counted)
+        {
+            break;
+        }
+    }
+
+    this->armed = true;
+
+    // a watch point only fires on the way up, a count that is already past it is caught here
+    return this->GetPulses() >= this->target && this->armed.exchange(false);
+}
+
+uint32_t FlowMeter::GetPulses()
+{
+    if (this->unit == NULL)
+    {
+        return 0;
+    }
+
+    int count = 0;
+    portENTER_CRITICAL(&this->lock);
+    pcnt_unit_get_count(this->unit, &count);
+    uint32_t pulses = this->offset + (this->overflows * highLimit) + count;
+    portEXIT_CRITICAL(&this->lock);
+
+    return pulses;
+}
+
+bool FlowMeter::onReach(pcnt_unit_handle_t unit, const pcnt_watch_event_data_t *edata, void *userCtx)
+{
+    FlowMeter *instance = (FlowMeter *)userCtx;
+
+    portENTER_CRITICAL_ISR(&instance->lock);
+    if (edata->watch_point_value == highLimit)
+    {
+        instance->overflows = instance->overflows + 1;
+    }
+
+    uint32_t pulses = instance->offset + (instance->overflows * highLimit);
+    if (edata->watch_point_value != highLimit)
+    {
+        pulses += edata->watch_point_value;
+    }
+    portEXIT_CRITICAL_ISR(&instance->lock);
+
+    if (!instance->armed || pulses < instance->target)
+    {
+        return false;
+    }
+
+    return instance->targetReached();
+}
+
+#else
+
+esp_err_t FlowMeter::Init()
+{
+    ESP_LOGI(TAG, "Flow meter on %d using gpio isr", this->pin);
+
+    gpio_config_t io_conf = {};
+    io_conf.mode = GPIO_MODE_INPUT;
+    io_conf.pin_bit_mask = (1ULL << this->pin);
+    io_conf.pull_up_en = GPIO_PULLUP_ENABLE;
+    io_conf.intr_type = GPIO_INTR_POSEDGE;
+    gpio_config(&io_conf);
+
+    return gpio_isr_handler_add(this->pin, &this->pulseIsr, this);
+}
+
+void FlowMeter::Arm(uint32_t targetPulses)
+{
+    this->armed = false;
+    this->target = targetPulses;
+    this->pulses = 0;
+    this->armed = true;
+}
+
+bool FlowMeter::Extend(uint32_t morePulses)
+{
+    this->armed = false;
+    this->target = this->target + morePulses;
+    this->armed = true;
+
+    // the isr only looks at the target on a pulse, one that came in before arming is caught here
+    return this->pulses >= this->target && this->armed.exchange(false);
+}
+
+uint32_t FlowMeter::GetPulses()
+{
+    return this->pulses;
+}
+
+void FlowMeter::pulseIsr(void *arg)
+{
+    FlowMeter *instance = (FlowMeter *)arg;
+
+    // only this isr writes the counter
+    instance->pulses = instance->pulses + 1;
+
+    if (!instance->armed || instance->pulses < instance->target)
+    {
+        return;
+    }
+
+    if (instance->targetReached())
+    {
+        portYIELD_FROM_ISR(pdTRUE);
+    }
+}
+
+#endif
+
+void FlowMeter::Disarm()
+{
+    this->armed = false;
+}
+
+// isr context, fires once per arm, Extend may have taken the target already
+bool FlowMeter::targetReached()
+{
+    if (!this->armed.exchange(false))
+    {
+        return false;
+    }
+
+    if (this->OnTarget == nullptr)
+    {
+        return false;
+    }
+
+    return this->OnTarget(this->fillerId, this->OnTargetArg);
+}
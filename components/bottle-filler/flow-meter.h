@@ -0,0 +1,78 @@
+/*
+ * esp-bolle-filler
+ * Copyright (C) Jeroen Dekien 2024 <dekien@gmail.com>
+ *
+ */
+
+#ifndef _FLOW_METER_H_
+#define _FLOW_METER_H_
+
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "driver/gpio.h"
+#include "soc/soc_caps.h"
+
+#if SOC_PCNT_SUPPORTED
+#include "driver/pulse_cnt.h"
+#endif
+
+#include <iostream>
+#include <atomic>
+
+using namespace std;
+
+// called from isr context when the armed pulse target is reached, return true when a higher priority task was woken
+typedef bool (*FlowTargetCallback)(uint8_t fillerId, void *arg);
+
+// Counts the pulses of a hall-effect flow meter.
+// Uses the PCNT peripheral when the chip has one, so counting costs no cpu, otherwise falls back to a gpio isr (esp32-c3).
+class FlowMeter
+{
+private:
+    gpio_num_t pin;
+    uint8_t fillerId;
+
+    std::atomic<bool> armed = false; // cleared by whoever takes the target, the isr or Extend
+    volatile uint32_t target = 0;
+
+#if SOC_PCNT_SUPPORTED
+    static bool onReach(pcnt_unit_handle_t unit, const pcnt_watch_event_data_t *edata, void *userCtx);
+
+    // the hardware counter is 16 bit, we count the overflows ourselves
+    static const int highLimit = 32767;
+
+    pcnt_unit_handle_t unit = NULL;
+    pcnt_channel_handle_t channel = NULL;
+    volatile uint32_t overflows = 0;
+    volatile uint32_t offset = 0; // pulses counted before the last clear of Extend
+    int targetWatchPoint = 0;     // 0 when none is set
+    portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+
+    void setTargetWatchPoint(uint32_t remaining);
+#else
+    static void pulseIsr(void *arg);
+
+    volatile uint32_t pulses = 0;
+#endif
+
+    bool targetReached();
+
+public:
+    FlowMeter(gpio_num_t pin, uint8_t fillerId); // constructor
+    ~FlowMeter();
+
+    esp_err_t Init();
+
+    // resets the count and calls the callback once the target is reached
+    void Arm(uint32_t targetPulses);
+    // moves the target on without resetting the count, so no pulse is lost between two stages
+    // returns true when the count is already past the new target, the callback is not called then
+    bool Extend(uint32_t morePulses);
+    void Disarm();
+    uint32_t GetPulses();
+
+    FlowTargetCallback OnTarget = nullptr;
+    void *OnTargetArg = nullptr;
+};
+
+#endif // _FLOW_METER_H_
@@ -0,0 +1,210 @@
+/*
+ * esp-bolle-filler
+ * Copyright (C) Jeroen Dekien 2024 <dekien@gmail.com>
+ *
+ */
+
+#include <algorithm>
+#include <map>
+#include <vector>
+
+#include "driver/gpio.h"
+#include "driver/pulse_cnt.h"
+#include "soc/soc_caps.h"
+
+#include "fake-peripherals.h"
+
+using namespace std;
+
+struct pcnt_unit_t
+{
+    int highLimit = 0;
+    int count = 0;
+    int pin = -1;
+    bool running = false;
+    vector<int> watchPoints;  // as added
+    vector<int> activeWatchPoints; // taken over at the last clear
+    pcnt_watch_cb_t onReach = nullptr;
+    void *userData = nullptr;
+};
+
+struct pcnt_chan_t
+{
+    pcnt_unit_t *unit;
+};
+
+struct IsrHandler
+{
+    gpio_isr_t handler;
+    void *arg;
+};
+
+static vector<pcnt_unit_t *> units;
+static map<int, IsrHandler> isrHandlers;
+
+esp_err_t pcnt_new_unit(const pcnt_unit_config_t *config, pcnt_unit_handle_t *unit)
+{
+    *unit = new pcnt_unit_t();
+    (*unit)->highLimit = config->high_limit;
+    units.push_back(*unit);
+    return ESP_OK;
+}
+
+esp_err_t pcnt_del_unit(pcnt_unit_handle_t unit)
+{
+    units.erase(std::remove(units.begin(), units.end(), unit), units.end());
+    delete unit;
+    return ESP_OK;
+}
+
+esp_err_t pcnt_unit_set_glitch_filter(pcnt_unit_handle_t unit, const pcnt_glitch_filter_config_t *config)
+{
+    return ESP_OK;
+}
+
+esp_err_t pcnt_new_channel(pcnt_unit_handle_t unit, const pcnt_chan_config_t *config, pcnt_channel_handle_t *channel)
+{
+    unit->pin = config->edge_gpio_num;
+    *channel = new pcnt_chan_t{unit};
+    return ESP_OK;
+}
+
+esp_err_t pcnt_del_channel(pcnt_channel_handle_t channel)
+{
+    delete channel;
+    return ESP_OK;
+}
+
+esp_err_t pcnt_channel_set_edge_action(pcnt_channel_handle_t channel, pcnt_channel_edge_action_t positive, pcnt_channel_edge_action_t negative)
+{
+    return ESP_OK;
+}
+
+esp_err_t pcnt_unit_register_event_callbacks(pcnt_unit_handle_t unit, const pcnt_event_callbacks_t *callbacks, void *userData)
+{
+    unit->onReach = callbacks->on_reach;
+    unit->userData = userData;
+    return ESP_OK;
+}
+
+esp_err_t pcnt_unit_add_watch_point(pcnt_unit_handle_t unit, int value)
+{
+    if (value > unit->highLimit || std::find(unit->watchPoints.begin(), unit->watchPoints.end(), value) != unit->watchPoints.end())
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    unit->watchPoints.push_back(value);
+    return ESP_OK;
+}
+
+esp_err_t pcnt_unit_remove_watch_point(pcnt_unit_handle_t unit, int value)
+{
+    auto it = std::find(unit->watchPoints.begin(), unit->watchPoints.end(), value);
+    if (it == unit->watchPoints.end())
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    unit->watchPoints.erase(it);
+
+    // a removed watch point is disabled at once
+    unit->activeWatchPoints.erase(std::remove(unit->activeWatchPoints.begin(), unit->activeWatchPoints.end(), value), unit->activeWatchPoints.end());
+    return ESP_OK;
+}
+
+esp_err_t pcnt_unit_enable(pcnt_unit_handle_t unit)
+{
+    return ESP_OK;
+}
+
+esp_err_t pcnt_unit_disable(pcnt_unit_handle_t unit)
+{
+    return ESP_OK;
+}
+
+esp_err_t pcnt_unit_start(pcnt_unit_handle_t unit)
+{
+    unit->running = true;
+    return ESP_OK;
+}
+
+esp_err_t pcnt_unit_stop(pcnt_unit_handle_t unit)
+{
+    unit->running = false;
+    return ESP_OK;
+}
+
+esp_err_t pcnt_unit_clear_count(pcnt_unit_handle_t unit)
+{
+    unit->count = 0;
+    unit->activeWatchPoints = unit->watchPoints;
+    return ESP_OK;
+}
+
+esp_err_t pcnt_unit_get_count(pcnt_unit_handle_t unit, int *value)
+{
+    *value = unit->count;
+    return ESP_OK;
+}
+
+esp_err_t gpio_config(const gpio_config_t *config)
+{
+    return ESP_OK;
+}
+
+esp_err_t gpio_isr_handler_add(gpio_num_t pin, gpio_isr_t handler, void *arg)
+{
+    isrHandlers[pin] = {handler, arg};
+    return ESP_OK;
+}
+
+esp_err_t gpio_isr_handler_remove(gpio_num_t pin)
+{
+    isrHandlers.erase(pin);
+    return ESP_OK;
+}
+
+static void pcntPulse(pcnt_unit_t *unit)
+{
+    if (!unit->running)
+    {
+        return;
+    }
+
+    unit->count++;
+
+    bool reached = std::find(unit->activeWatchPoints.begin(), unit->activeWatchPoints.end(), unit->count) != unit->activeWatchPoints.end();
+    pcnt_watch_event_data_t event = {unit->count};
+
+    // the counter is back at 0 before the event is handled
+    if (unit->count == unit->highLimit)
+    {
+        unit->count = 0;
+    }
+
+    if (reached && unit->onReach != nullptr)
+    {
+        unit->onReach(unit, &event, unit->userData);
+    }
+}
+
+void fakePulses(gpio_num_t pin, uint32_t pulses)
+{
+    for (uint32_t i = 0; i < pulses; i++)
+    {
+        for (pcnt_unit_t *unit : units)
+        {
+            if (unit->pin == pin)
+            {
+                pcntPulse(unit);
+            }
+        }
+
+        auto handler = isrHandlers.find(pin);
+        if (handler != isrHandlers.end())
+        {
+            handler->second.handler(handler->second.arg);
+        }
+    }
+}
@@ -0,0 +1,17 @@
+/*
+ * esp-bolle-filler
+ * Copyright (C) Jeroen Dekien 2024 <dekien@gmail.com>
+ *
+ */
+
+#ifndef _FAKE_PERIPHERALS_H_
+#define _FAKE_PERIPHERALS_H_
+
+#include "driver/gpio.h"
+
+// Simulated pulses on a pin, as a flow meter gives them.
+// With pcnt the pulses go to the unit on that pin: a watch point only takes effect after the count is cleared,
+// like the hardware thresholds, and the count resets to 0 at the high limit. Without pcnt the gpio isr is called.
+void fakePulses(gpio_num_t pin, uint32_t pulses);
+
+#endif // _FAKE_PERIPHERALS_H_
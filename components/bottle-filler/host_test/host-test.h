@@ -0,0 +1,47 @@
+/*
+ * esp-bolle-filler
+ * Copyright (C) Jeroen Dekien 2024 <dekien@gmail.com>
+ *
+ */
+
+#ifndef _HOST_TEST_H_
+#define _HOST_TEST_H_
+
+#include <cstdio>
+
+// each test is a plain executable, main returns the number of failed checks
+static int hostTestFailures = 0;
+
+#define CHECK(condition)                                                             \
+    do                                                                               \
+    {                                                                                \
+        if (!(condition))                                                            \
+        {                                                                            \
+            printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition);     \
+            hostTestFailures++;                                                      \
+        }                                                                            \
+    } while (0)
+
+#define CHECK_EQ(actual, expected)                                                   \
+    do                                                                               \
+    {                                                                                \
+        auto a_ = (actual);                                                          \
+        auto e_ = (expected);                                                        \
+        if (!(a_ == e_))                                                             \
+        {                                                                            \
+            printf("%s:%d: CHECK_EQ(%s, %s) failed, got %lld expected %lld\n",       \
+                   __FILE__, __LINE__, #actual, #expected, (long long)a_, (long long)e_); \
+            hostTestFailures++;                                                      \
+        }                                                                            \
+    } while (0)
+
+#define RUN_TEST(test)                \
+    do                                \
+    {                                 \
+        printf("%s\n", #test);        \
+        test();                       \
+    } while (0)
+
+#define HOST_TEST_RESULT() (hostTestFailures == 0 ? 0 : 1)
+
+#endif // _HOST_TEST_H_
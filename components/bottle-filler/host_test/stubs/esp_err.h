@@ -0,0 +1,36 @@
+/*
+ * esp-bolle-filler
+ * Copyright (C) Jeroen Dekien 2024 <dekien@gmail.com>
+ *
+ */
+
+// host stand in for the esp-idf header, only what the tested code uses
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+
+typedef int esp_err_t;
+
+#define ESP_OK 0
+#define ESP_FAIL -1
+#define ESP_ERR_NO_MEM 0x101
+#define ESP_ERR_INVALID_ARG 0x102
+#define ESP_ERR_INVALID_STATE 0x103
+#define ESP_ERR_NOT_FOUND 0x105
+
+inline const char *esp_err_to_name(esp_err_t code)
+{
+    return code == ESP_OK ? "ESP_OK" : "ESP_ERR";
+}
+
+#define ESP_ERROR_CHECK(x)                                               \
+    do                                                                   \
+    {                                                                    \
+        esp_err_t err_ = (x);                                            \
+        if (err_ != ESP_OK)                                              \
+        {                                                                \
+            printf("%s:%d: ESP_ERROR_CHECK failed %d\n", __FILE__, __LINE__, err_); \
+            abort();                                                     \
+        }                                                                \
+    } while (0)
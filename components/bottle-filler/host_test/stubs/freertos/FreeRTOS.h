@@ -0,0 +1,28 @@
+/*
+ * esp-bolle-filler
+ * Copyright (C) Jeroen Dekien 2024 <dekien@gmail.com>
+ *
+ */
+
+// host stand in for the esp-idf header, the tests run single threaded so critical sections do nothing
+#pragma once
+
+#include <cstdint>
+
+typedef int BaseType_t;
+
+#define pdTRUE 1
+#define pdFALSE 0
+
+typedef struct
+{
+    int locked;
+} portMUX_TYPE;
+
+#define portMUX_INITIALIZER_UNLOCKED {0}
+
+#define portENTER_CRITICAL(mux) (void)(mux)
+#define portEXIT_CRITICAL(mux) (void)(mux)
+#define portENTER_CRITICAL_ISR(mux) (void)(mux)
+#define portEXIT_CRITICAL_ISR(mux) (void)(mux)
+#define portYIELD_FROM_ISR(woken) (void)(woken)
@@ -0,0 +1,12 @@
+/*
+ * esp-bolle-filler
+ * Copyright (C) Jeroen Dekien 2024 <dekien@gmail.com>
+ *
+ */
+
+// host stand in for the esp-idf header, the flow meter test is built with and without pcnt
+#pragma once
+
+#ifndef SOC_PCNT_SUPPORTED
+#define SOC_PCNT_SUPPORTED 1
+#endif
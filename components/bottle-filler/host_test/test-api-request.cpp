@@ -0,0 +1,140 @@
+/*
+ * esp-bolle-filler
+ * Copyright (C) Jeroen Dekien 2024 <dekien@gmail.com>
+ *
+ */
+
+#include <cstdint>
+
+#include "host-test.h"
+#include "api-request.h"
+
+static bool needsData(uint32_t hash)
+{
+    return hash == commandHash("SaveFillerSettings");
+}
+
+static bool parse(const char *text, ApiRequest &request)
+{
+    ApiRequestParser parser(request, &needsData);
+    return json::sax_parse(text, &parser) && parser.Complete();
+}
+
+static void hashIsFnv1a()
+{
+    // reference values of 32 bit FNV-1a
+    CHECK_EQ(commandHash(""), 2166136261u);
+    CHECK_EQ(commandHash("a"), 0xe40c292cu);
+    CHECK_EQ(commandHash("foobar"), 0xbf9cf968u);
+}
+
+static void picksScalarsWithoutData()
+{
+    ApiRequest request;
+
+    CHECK(parse(R"({"command":"StartFill","data":{"id":3,"time":1500,"handle":7}})", request));
+    CHECK_EQ(request.CommandHash, commandHash("StartFill"));
+    CHECK(strcmp(request.Command, "StartFill") == 0);
+    CHECK(request.HasId);
+    CHECK_EQ(request.Id, 3u);
+    CHECK(request.HasTime);
+    CHECK_EQ(request.Time, 1500u);
+    CHECK(request.HasHandle);
+    CHECK_EQ(request.Handle, 7u);
+    CHECK(request.Data.is_null());
+}
+
+static void buildsDataWhenNeeded()
+{
+    ApiRequest request;
+
+    CHECK(parse(R"({"command":"SaveFillerSettings","data":{"id":1,"stages":[[500,100],[50,30]]}})", request));
+    CHECK(request.Data.is_object());
+    CHECK_EQ(request.Data["id"].get<int>(), 1);
+    CHECK_EQ(request.Data["stages"].size(), 2u);
+}
+
+static void buildsDataWhenItComesFirst()
+{
+    ApiRequest request;
+
+    CHECK(parse(R"({"data":{"id":2},"command":"StartFill"})", request));
+    CHECK(request.HasId);
+    CHECK_EQ(request.Id, 2u);
+    CHECK(request.Data.is_object());
+}
+
+static void nestedValuesAreNotScalars()
+{
+    ApiRequest request;
+
+    CHECK(parse(R"({"command":"StartFill","data":{"other":{"id":9},"list":[5],"id":4}})", request));
+    CHECK_EQ(request.Id, 4u);
+}
+
+static void negativeIsNotCaptured()
+{
+    ApiRequest request;
+
+    CHECK(parse(R"({"command":"StartFill","data":{"id":-1}})", request));
+    CHECK(!request.HasId);
+}
+
+static void longCommandIsCut()
+{
+    ApiRequest request;
+
+    CHECK(parse(R"({"command":"ACommandNameThatIsLongerThanThirtyTwoCharacters"})", request));
+    CHECK_EQ(strlen(request.Command), sizeof(request.Command) - 1);
+    CHECK_EQ(request.CommandHash, commandHash("ACommandNameThatIsLongerThanThirtyTwoCharacters"));
+}
+
+static void refusesIncomplete()
+{
+    ApiRequest request;
+
+    CHECK(!parse(R"({"data":{"id":2}})", request));
+    CHECK(!parse(R"({"command":"StartFill","data":{"id":2})", request));
+    CHECK(!parse(R"(["StartFill"])", request));
+    CHECK(!parse(R"("StartFill")", request));
+}
+
+static constexpr ApiCommandName commands[] = {"Start", "AbortFill"};
+
+static void knowsItsCommands()
+{
+    ApiRequest request;
+
+    CHECK(parse(R"({"command":"AbortFill"})", request));
+    CHECK(commandKnown(commands, request));
+
+    ApiRequest other;
+    CHECK(parse(R"({"command":"Stop"})", other));
+    CHECK(!commandKnown(commands, other));
+}
+
+// a name that only shares the hash of a command must not run it
+static void hashCollisionIsUnknown()
+{
+    ApiRequest request;
+    request.CommandHash = commandHash("Start");
+    strcpy(request.Command, "Strat");
+
+    CHECK(!commandKnown(commands, request));
+}
+
+int main()
+{
+    RUN_TEST(hashIsFnv1a);
+    RUN_TEST(picksScalarsWithoutData);
+    RUN_TEST(buildsDataWhenNeeded);
+    RUN_TEST(buildsDataWhenItComesFirst);
+    RUN_TEST(nestedValuesAreNotScalars);
+    RUN_TEST(negativeIsNotCaptured);
+    RUN_TEST(longCommandIsCut);
+    RUN_TEST(refusesIncomplete);
+    RUN_TEST(knowsItsCommands);
+    RUN_TEST(hashCollisionIsUnknown);
+
+    return HOST_TEST_RESULT();
+}
@@ -0,0 +1,53 @@
+/*
+ * esp-bolle-filler
+ * Copyright (C) Jeroen Dekien 2024 <dekien@gmail.com>
+ *
+ */
+
+#include <cstdint>
+#include <functional>
+#include <queue>
+#include <vector>
+
+#include "host-test.h"
+#include "fill-command.h"
+
+// the scheduler keeps its deadlines in a min heap on At
+static void deadlinesPopEarliestFirst()
+{
+    std::priority_queue<FillDeadline, std::vector<FillDeadline>, std::greater<FillDeadline>> deadlines;
+
+    deadlines.push({300, StageEnd, 0, 1});
+    deadlines.push({100, Settle, 1, 1});
+    deadlines.push({200, Flush, 0, 0});
+
+    CHECK_EQ(deadlines.top().At, 100);
+    deadlines.pop();
+    CHECK_EQ(deadlines.top().At, 200);
+    deadlines.pop();
+    CHECK_EQ(deadlines.top().At, 300);
+}
+
+// pending starts go oldest first, the lower filler id first when queued at the same time
+static void pendingStartsOldestFirst()
+{
+    std::priority_queue<PendingStart, std::vector<PendingStart>, std::greater<PendingStart>> pending;
+
+    pending.push({20, StartFill, 0, 1});
+    pending.push({10, StartFill, 3, 1});
+    pending.push({10, StartFill, 1, 1});
+
+    CHECK_EQ(pending.top().FillerId, 1);
+    pending.pop();
+    CHECK_EQ(pending.top().FillerId, 3);
+    pending.pop();
+    CHECK_EQ(pending.top().FillerId, 0);
+}
+
+int main()
+{
+    RUN_TEST(deadlinesPopEarliestFirst);
+    RUN_TEST(pendingStartsOldestFirst);
+
+    return HOST_TEST_RESULT();
+}
@@ -0,0 +1,114 @@
+/*
+ * esp-bolle-filler
+ * Copyright (C) Jeroen Dekien 2024 <dekien@gmail.com>
+ *
+ */
+
+#include <cmath>
+#include <cstdint>
+
+#include "host-test.h"
+#include "fill-run.h"
+
+static FillRun twoStageRun(FillMode mode, uint32_t first, uint32_t second)
+{
+    FillRun run = {};
+    run.Mode = mode;
+    run.Stages[0] = {first, 100, 0};
+    run.Stages[1] = {second, 30, 0};
+    run.StageCount = 2;
+    run.Stage = 0;
+    return run;
+}
+
+static void stagePulsesCompensateTheLastStageOnly()
+{
+    FillRun run = twoStageRun(FlowMode, 400, 100);
+    run.Compensation = 20;
+
+    // 450 pulses per liter
+    CHECK_EQ(run.StagePulses(450), 180u);
+    run.Stage = 1;
+    CHECK_EQ(run.StagePulses(450), 45u - 20u);
+}
+
+static void stagePulsesNeverZero()
+{
+    FillRun run = twoStageRun(FlowMode, 400, 10);
+    run.Stage = 1;
+    run.Compensation = 1000;
+
+    CHECK_EQ(run.StagePulses(450), 1u);
+}
+
+static void stagePulsesDoNotOverflow()
+{
+    FillRun run = twoStageRun(FlowMode, 400, 4000000);
+    run.Stage = 1;
+
+    CHECK_EQ(run.StagePulses(5000), 20000000u);
+}
+
+static void stageEndsAtMovesTheLastStageForward()
+{
+    FillRun run = twoStageRun(TimeMode, 2000, 500);
+    run.Compensation = 30000; // us
+
+    CHECK_EQ(run.StageEndsAt(1000000), 1000000 + 2000000);
+    run.Stage = 1;
+    CHECK_EQ(run.StageEndsAt(3000000), 3000000 + 500000 - 30000);
+}
+
+static void stageEndsAtNotBeforeItsStart()
+{
+    FillRun run = twoStageRun(TimeMode, 2000, 10);
+    run.Stage = 1;
+    run.Compensation = 50000;
+
+    CHECK_EQ(run.StageEndsAt(3000000), 3000000);
+}
+
+static void stageWeightAddsUp()
+{
+    FillRun run = twoStageRun(WeightMode, 300, 30);
+    run.Compensation = 4500; // mg
+
+    CHECK(std::fabs(run.StageWeight() - 300.0f) < 0.001f);
+    run.Stage = 1;
+    CHECK(std::fabs(run.StageWeight() - (330.0f - 4.5f)) < 0.001f);
+}
+
+static void endsAtOnlyInTimeMode()
+{
+    FillRun run = twoStageRun(TimeMode, 2000, 500);
+
+    CHECK_EQ(run.EndsAt(1000000), 1000000 + 2500000);
+
+    run.Mode = FlowMode;
+    CHECK_EQ(run.EndsAt(1000000), 0);
+}
+
+static void compensationUsesInFlightWeightUntilLearned()
+{
+    OvershootEstimator estimator;
+
+    CHECK_EQ(fillCompensation(WeightMode, estimator, 2.5f), 2500);
+    CHECK_EQ(fillCompensation(FlowMode, estimator, 2.5f), 0);
+
+    estimator.Update(1800);
+    CHECK_EQ(fillCompensation(WeightMode, estimator, 2.5f), 1800);
+}
+
+int main()
+{
+    RUN_TEST(stagePulsesCompensateTheLastStageOnly);
+    RUN_TEST(stagePulsesNeverZero);
+    RUN_TEST(stagePulsesDoNotOverflow);
+    RUN_TEST(stageEndsAtMovesTheLastStageForward);
+    RUN_TEST(stageEndsAtNotBeforeItsStart);
+    RUN_TEST(stageWeightAddsUp);
+    RUN_TEST(endsAtOnlyInTimeMode);
+    RUN_TEST(compensationUsesInFlightWeightUntilLearned);
+
+    return HOST_TEST_RESULT();
+}
@@ -0,0 +1,166 @@
+/*
+ * esp-bolle-filler
+ * Copyright (C) Jeroen Dekien 2024 <dekien@gmail.com>
+ *
+ */
+
+#include <cstdint>
+#include <vector>
+
+#include "host-test.h"
+#include "fake-peripherals.h"
+#include "flow-meter.h"
+
+static const gpio_num_t flowPin = 4;
+
+// what the fill scheduler sees of a flow meter, the pulse count at each target
+struct TargetLog
+{
+    FlowMeter *meter;
+    std::vector<uint32_t> reachedAt;
+};
+
+static bool onTarget(uint8_t fillerId, void *arg)
+{
+    TargetLog *log = (TargetLog *)arg;
+    log->reachedAt.push_back(log->meter->GetPulses());
+    return false;
+}
+
+static void setup(FlowMeter &meter, TargetLog &log)
+{
+    log.meter = &meter;
+    meter.OnTarget = &onTarget;
+    meter.OnTargetArg = &log;
+    CHECK_EQ(meter.Init(), ESP_OK);
+}
+
+static void reachesTheArmedTarget()
+{
+    FlowMeter meter(flowPin, 0);
+    TargetLog log;
+    setup(meter, log);
+
+    meter.Arm(100);
+    fakePulses(flowPin, 99);
+    CHECK_EQ(log.reachedAt.size(), 0u);
+
+    fakePulses(flowPin, 1);
+    CHECK_EQ(log.reachedAt.size(), 1u);
+    CHECK_EQ(log.reachedAt[0], 100u);
+
+    // once per arm
+    fakePulses(flowPin, 50);
+    CHECK_EQ(log.reachedAt.size(), 1u);
+    CHECK_EQ(meter.GetPulses(), 150u);
+}
+
+static void reachesATargetPastTheHighLimit()
+{
+    FlowMeter meter(flowPin, 0);
+    TargetLog log;
+    setup(meter, log);
+
+    meter.Arm(70000);
+    fakePulses(flowPin, 69999);
+    CHECK_EQ(log.reachedAt.size(), 0u);
+    fakePulses(flowPin, 1);
+    CHECK_EQ(log.reachedAt.size(), 1u);
+    CHECK_EQ(meter.GetPulses(), 70000u);
+
+    // a multiple of the high limit is caught by the overflow watch point
+    meter.Arm(65534);
+    fakePulses(flowPin, 65534);
+    CHECK_EQ(log.reachedAt.size(), 2u);
+    CHECK_EQ(log.reachedAt[1], 65534u);
+}
+
+// the way the fill scheduler runs the stages: each target moves on with Extend while the pump keeps running
+static void runsThroughTheStages()
+{
+    FlowMeter meter(flowPin, 0);
+    TargetLog log;
+    setup(meter, log);
+
+    const uint32_t stages[] = {180, 45, 40000, 20};
+    uint32_t total = 0;
+
+    meter.Arm(stages[0]);
+    total += stages[0];
+
+    for (int stage = 0; stage < 4; stage++)
+    {
+        fakePulses(flowPin, total - meter.GetPulses() - 1);
+        CHECK_EQ(log.reachedAt.size(), (size_t)stage);
+
+        fakePulses(flowPin, 1);
+        CHECK_EQ(log.reachedAt.size(), (size_t)stage + 1);
+        if (log.reachedAt.size() != (size_t)stage + 1)
+        {
+            break;
+        }
+        CHECK_EQ(log.reachedAt[stage], total);
+
+        if (stage == 3)
+        {
+            break;
+        }
+
+        // a few pulses come in before the scheduler gets to the next stage, they count for it
+        fakePulses(flowPin, 3);
+        CHECK(!meter.Extend(stages[stage + 1]));
+        total += stages[stage + 1];
+    }
+
+    CHECK_EQ(meter.GetPulses(), 180u + 45u + 40000u + 20u);
+}
+
+static void extendPastTheCount()
+{
+    FlowMeter meter(flowPin, 0);
+    TargetLog log;
+    setup(meter, log);
+
+    meter.Arm(10);
+    fakePulses(flowPin, 30);
+    CHECK_EQ(log.reachedAt.size(), 1u);
+
+    // the next stage is already done, the caller moves on without a callback
+    CHECK(meter.Extend(5));
+    CHECK(meter.Extend(15));
+    CHECK_EQ(log.reachedAt.size(), 1u);
+
+    CHECK(!meter.Extend(10));
+    fakePulses(flowPin, 9);
+    CHECK_EQ(log.reachedAt.size(), 1u);
+    fakePulses(flowPin, 1);
+    CHECK_EQ(log.reachedAt.size(), 2u);
+    CHECK_EQ(log.reachedAt[1], 40u);
+}
+
+static void disarmStopsTheCallback()
+{
+    FlowMeter meter(flowPin, 0);
+    TargetLog log;
+    setup(meter, log);
+
+    meter.Arm(10);
+    meter.Disarm();
+    fakePulses(flowPin, 20);
+
+    CHECK_EQ(log.reachedAt.size(), 0u);
+    CHECK_EQ(meter.GetPulses(), 20u);
+}
+
+int main()
+{
+    printf("flow meter %s\n", SOC_PCNT_SUPPORTED ? "pcnt" : "gpio isr");
+
+    RUN_TEST(reachesTheArmedTarget);
+    RUN_TEST(reachesATargetPastTheHighLimit);
+    RUN_TEST(runsThroughTheStages);
+    RUN_TEST(extendPastTheCount);
+    RUN_TEST(disarmStopsTheCallback);
+
+    return HOST_TEST_RESULT();
+}
@@ -0,0 +1,107 @@
+/*
+ * esp-bolle-filler
+ * Copyright (C) Jeroen Dekien 2024 <dekien@gmail.com>
+ *
+ */
+
+#include <cstdint>
+
+#include "host-test.h"
+#include "overshoot-estimator.h"
+
+static void firstSampleIsTakenAsIs()
+{
+    OvershootEstimator estimator;
+
+    estimator.Update(120);
+
+    CHECK_EQ(estimator.Get(), 120);
+    CHECK_EQ(estimator.Samples, 1);
+}
+
+static void laterSamplesCountForAnEighth()
+{
+    OvershootEstimator estimator;
+
+    estimator.Update(100);
+    estimator.Update(180);
+
+    // 100 + (180 - 100) / 8
+    CHECK_EQ(estimator.Get(), 110);
+    CHECK_EQ(estimator.Samples, 2);
+}
+
+static void convergesOnAStableValue()
+{
+    OvershootEstimator estimator;
+
+    estimator.Update(0);
+    for (int i = 0; i < 100; i++)
+    {
+        estimator.Update(50);
+    }
+
+    CHECK_EQ(estimator.Get(), 50);
+}
+
+static void negativeIsLearnedAsZero()
+{
+    OvershootEstimator estimator;
+
+    estimator.Update(-40);
+
+    CHECK_EQ(estimator.Get(), 0);
+    CHECK_EQ(estimator.Samples, 1);
+}
+
+static void largeSamplesDoNotOverflow()
+{
+    OvershootEstimator estimator;
+
+    estimator.Update(INT32_MAX);
+    CHECK(estimator.Get() > 0);
+    CHECK_EQ(estimator.Get(), INT32_MAX >> 4);
+
+    // the average stays between the samples
+    estimator.Update(0);
+    CHECK(estimator.Get() > 0);
+    CHECK(estimator.Get() < (INT32_MAX >> 4));
+
+    estimator.Update(INT32_MAX);
+    CHECK(estimator.Get() > 0);
+}
+
+static void samplesSaturate()
+{
+    OvershootEstimator estimator;
+    estimator.Samples = UINT16_MAX - 1;
+
+    estimator.Update(10);
+    estimator.Update(10);
+
+    CHECK_EQ(estimator.Samples, UINT16_MAX);
+}
+
+static void resetForgets()
+{
+    OvershootEstimator estimator;
+    estimator.Update(75);
+
+    estimator.Reset();
+
+    CHECK_EQ(estimator.Get(), 0);
+    CHECK_EQ(estimator.Samples, 0);
+}
+
+int main()
+{
+    RUN_TEST(firstSampleIsTakenAsIs);
+    RUN_TEST(laterSamplesCountForAnEighth);
+    RUN_TEST(convergesOnAStableValue);
+    RUN_TEST(negativeIsLearnedAsZero);
+    RUN_TEST(largeSamplesDoNotOverflow);
+    RUN_TEST(samplesSaturate);
+    RUN_TEST(resetForgets);
+
+    return HOST_TEST_RESULT();
+}
@@ -0,0 +1,120 @@
+/*
+ * esp-bolle-filler
+ * Copyright (C) Jeroen Dekien 2024 <dekien@gmail.com>
+ *
+ */
+
+#include <cstdint>
+#include <thread>
+
+#include "host-test.h"
+#include "ring-buffer.h"
+
+static void popsInPushOrder()
+{
+    RingBuffer<int, 4> ring;
+    int item = 0;
+
+    CHECK(ring.Push(1));
+    CHECK(ring.Push(2));
+
+    CHECK(ring.Pop(item));
+    CHECK_EQ(item, 1);
+    CHECK(ring.Pop(item));
+    CHECK_EQ(item, 2);
+    CHECK(!ring.Pop(item));
+}
+
+static void refusesWhenFull()
+{
+    RingBuffer<int, 4> ring;
+    int item = 0;
+
+    for (int i = 0; i < 4; i++)
+    {
+        CHECK(ring.Push(i));
+    }
+    CHECK(!ring.Push(4));
+
+    // one slot free again
+    CHECK(ring.Pop(item));
+    CHECK_EQ(item, 0);
+    CHECK(ring.Push(4));
+}
+
+static void wrapsAround()
+{
+    RingBuffer<int, 4> ring;
+    int item = 0;
+
+    for (int i = 0; i < 1000; i++)
+    {
+        CHECK(ring.Push(i));
+        CHECK(ring.Pop(item));
+        CHECK_EQ(item, i);
+    }
+}
+
+static void clearDropsQueued()
+{
+    RingBuffer<int, 4> ring;
+    int item = 0;
+
+    ring.Push(1);
+    ring.Push(2);
+    ring.Clear();
+
+    CHECK(!ring.Pop(item));
+    CHECK(ring.Push(3));
+    CHECK(ring.Pop(item));
+    CHECK_EQ(item, 3);
+}
+
+// one producer and one consumer thread, nothing may be lost, duplicated or reordered
+static void producerConsumer()
+{
+    RingBuffer<uint32_t, 16> ring;
+    const uint32_t count = 200000;
+
+    std::thread producer([&]()
+                         {
+        for (uint32_t i = 0; i < count; i++)
+        {
+            while (!ring.Push(i))
+            {
+                std::this_thread::yield();
+            }
+        } });
+
+    uint32_t expected = 0;
+    uint32_t item = 0;
+    while (expected < count)
+    {
+        if (ring.Pop(item))
+        {
+            if (item != expected)
+            {
+                break;
+            }
+            expected++;
+        }
+        else
+        {
+            std::this_thread::yield();
+        }
+    }
+
+    producer.join();
+    CHECK_EQ(expected, count);
+}
+
+int main()
+{
+    RUN_TEST(popsInPushOrder);
+    RUN_TEST(refusesWhenFull);
+    RUN_TEST(wrapsAround);
+    RUN_TEST(clearDropsQueued);
+    RUN_TEST(producerConsumer);
+
+    return HOST_TEST_RESULT();
+}
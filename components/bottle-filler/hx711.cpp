@@ -0,0 +1,107 @@
+/*
+ * esp-bottle-filler
+ * Copyright (C) Dekien Jeroen 2024
+ */
+#include "hx711.h"
+
+using namespace std;
+
+static const char *TAG = "HX711";
+
+HX711::HX711(gpio_num_t dataPin, gpio_num_t clockPin)
+{
+    this->dataPin = dataPin;
+    this->clockPin = clockPin;
+}
+
+esp_err_t HX711::Init()
+{
+    ESP_LOGI(TAG, "HX711 on Data:%d Clock:%d", this->dataPin, this->clockPin);
+
+    gpio_config_t io_conf = {};
+    io_conf.mode = GPIO_MODE_INPUT;
+    io_conf.pin_bit_mask = (1ULL << this->dataPin);
+    esp_err_t err = gpio_config(&io_conf);
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+
+    io_conf.mode = GPIO_MODE_OUTPUT;
+    io_conf.pin_bit_mask = (1ULL << this->clockPin);
+    err = gpio_config(&io_conf);
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+
+    // clock high for more then 60us powers the chip down, keep it low
+    gpio_set_level(this->clockPin, 0);
+
+    return ESP_OK;
+}
+
+bool HX711::IsReady()
+{
+    // data goes low when a conversion is ready
+    return gpio_get_level(this->dataPin) == 0;
+}
+
+int32_t HX711::read()
+{
+    uint32_t value = 0;
+
+    // the clock must not stay high for 60us, so no interrupts while shifting
+    portENTER_CRITICAL(&this->spinlock);
+
+    for (uint8_t i = 0; i < 24; i++)
+    {
+        gpio_set_level(this->clockPin, 1);
+        esp_rom_delay_us(1);
+        value = (value << 1) | gpio_get_level(this->dataPin);
+        gpio_set_level(this->clockPin, 0);
+        esp_rom_delay_us(1);
+    }
+
+    // 25th pulse selects channel A gain 128 for the next conversion
+    gpio_set_level(this->clockPin, 1);
+    esp_rom_delay_us(1);
+    gpio_set_level(this->clockPin, 0);
+
+    portEXIT_CRITICAL(&this->spinlock);
+
+    // sign extend the 24 bit two's complement value
+    if (value & 0x800000)
+    {
+        value |= 0xFF000000;
+    }
+
+    return (int32_t)value;
+}
+
+bool HX711::Update()
+{
+    if (!this->IsReady())
+    {
+        return false;
+    }
+
+    this->samples[this->nextSample] = this->read();
+    this->nextSample = (this->nextSample + 1) % 3;
+
+    if (this->sampleCount < 3)
+    {
+        this->sampleCount++;
+        this->Value = this->samples[(this->nextSample + 2) % 3];
+        return true;
+    }
+
+    int32_t a = this->samples[0];
+    int32_t b = this->samples[1];
+    int32_t c = this->samples[2];
+
+    // median of 3
+    this->Value = std::max(std::min(a, b), std::min(std::max(a, b), c));
+
+    return true;
+}
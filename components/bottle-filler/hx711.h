@@ -0,0 +1,47 @@
+/*
+ * esp-bolle-filler
+ * Copyright (C) Jeroen Dekien 2024 <dekien@gmail.com>
+ *
+ */
+
+#ifndef _HX711_H_
+#define _HX711_H_
+
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "esp_rom_sys.h"
+#include "driver/gpio.h"
+
+#include <iostream>
+#include <algorithm>
+
+using namespace std;
+
+// Bit banged driver for the HX711 load cell amplifier, channel A with gain 128.
+// Samples are median filtered over 3 readings to drop the occasional spike without adding much lag.
+class HX711
+{
+private:
+    gpio_num_t dataPin;
+    gpio_num_t clockPin;
+    portMUX_TYPE spinlock = portMUX_INITIALIZER_UNLOCKED;
+
+    int32_t samples[3] = {};
+    uint8_t sampleCount = 0;
+    uint8_t nextSample = 0;
+
+    int32_t read();
+
+public:
+    HX711(gpio_num_t dataPin, gpio_num_t clockPin); // constructor
+
+    esp_err_t Init();
+    bool IsReady();
+
+    // reads a sample when one is ready, returns true when Value was updated
+    bool Update();
+
+    volatile int32_t Value = 0; // filtered raw value
+};
+
+#endif // _HX711_H_
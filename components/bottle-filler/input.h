@@ -15,7 +15,24 @@ using namespace std;
 enum InputFunction
 {
     AutoFill = 0,
-    ManualFill = 1
+    ManualFill = 1,
+    BottleSensor = 2 // low while a bottle is in place, drives the auto cycle
+};
+
+// how a press was classified by the glitch filter on release
+enum PressType
+{
+    GlitchPress = 0, // shorter than the min press time, ignored
+    ShortPress = 1,
+    LongPress = 2
+};
+
+// edge captured in the gpio isr, consumed by the input task
+struct InputEdge
+{
+    uint8_t InputIndex;
+    uint8_t Level;
+    int64_t Timestamp; // in us
 };
 
 class Input
@@ -23,10 +40,32 @@ class Input
 public:
     uint8_t Id;
     gpio_num_t GpioNr;
-    uint8_t CurrentLevel;
-    uint32_t LastChange;
+    uint8_t CurrentLevel; // debounced level
+    int64_t LastChange;   // in us, last accepted level change
     uint8_t FillerId;
     InputFunction Function;
+    uint32_t DebounceTime;  // in ms, level must be stable this long before it is accepted
+    uint32_t MinPressTime;  // in ms, shorter presses are rejected as glitches
+    uint32_t LongPressTime; // in ms, presses this long or longer are long presses
+
+    // gesture state, a short press waits for a possible second press
+    bool ShortPending;
+    int64_t ShortPendingUntil; // in us
+
+    // filter counters, used to tune the times above
+    uint32_t RejectedBounces;
+    uint32_t RejectedPresses;
+
+    // raw level as seen by the isr, waiting for debounce
+    uint8_t PendingLevel;
+    int64_t PendingSince; // in us
+
+    // same pin and settings, the runtime state is not compared
+    bool SameConfig(const Input &other) const
+    {
+        return this->GpioNr == other.GpioNr && this->FillerId == other.FillerId && this->Function == other.Function &&
+               this->DebounceTime == other.DebounceTime && this->MinPressTime == other.MinPressTime && this->LongPressTime == other.LongPressTime;
+    };
 
 protected:
 private:
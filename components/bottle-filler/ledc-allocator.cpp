@@ -0,0 +1,94 @@
+/*
+ * esp-bottle-filler
+ * Copyright (C) Dekien Jeroen 2024
+ */
+#include "ledc-allocator.h"
+
+using namespace std;
+
+static const char *TAG = "LedcAllocator";
+
+// low speed first, it is the only mode on most chips and keeps channel numbers the same as before
+ledc_mode_t LedcAllocator::speedMode(uint8_t index)
+{
+#if SOC_LEDC_SUPPORT_HS_MODE
+    if (index == 1)
+    {
+        return LEDC_HIGH_SPEED_MODE;
+    }
+#endif
+    return LEDC_LOW_SPEED_MODE;
+}
+
+esp_err_t LedcAllocator::Init(uint32_t frequency, ledc_timer_bit_t resolution)
+{
+    for (uint8_t i = 0; i < LEDC_SPEED_MODES; i++)
+    {
+        ledc_timer_config_t timerConfig = {};
+        timerConfig.speed_mode = speedMode(i);
+        timerConfig.timer_num = LEDC_TIMER_0;
+        timerConfig.duty_resolution = resolution;
+        timerConfig.freq_hz = frequency;
+        timerConfig.clk_cfg = LEDC_AUTO_CLK;
+
+        esp_err_t err = ledc_timer_config(&timerConfig);
+        if (err != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Timer of speed mode %d could not be configured: %s", timerConfig.speed_mode, esp_err_to_name(err));
+            return err;
+        }
+    }
+
+    this->configured = true;
+
+    ESP_LOGI(TAG, "%d pwm channels available", MAX_FILLERS);
+
+    return ESP_OK;
+}
+
+bool LedcAllocator::Allocate(LedcChannel *channel)
+{
+    if (!this->configured)
+    {
+        return false;
+    }
+
+    for (uint8_t i = 0; i < LEDC_SPEED_MODES; i++)
+    {
+        for (uint8_t c = 0; c < SOC_LEDC_CHANNEL_NUM; c++)
+        {
+            if ((this->used[i] & (1UL << c)) != 0)
+            {
+                continue;
+            }
+
+            this->used[i] |= (1UL << c);
+
+            channel->SpeedMode = speedMode(i);
+            channel->Channel = (ledc_channel_t)c;
+            channel->Timer = LEDC_TIMER_0;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void LedcAllocator::Release(const LedcChannel &channel)
+{
+    for (uint8_t i = 0; i < LEDC_SPEED_MODES; i++)
+    {
+        if (speedMode(i) == channel.SpeedMode && channel.Channel < SOC_LEDC_CHANNEL_NUM)
+        {
+            this->used[i] &= ~(1UL << channel.Channel);
+        }
+    }
+}
+
+void LedcAllocator::Reset()
+{
+    for (uint8_t i = 0; i < LEDC_SPEED_MODES; i++)
+    {
+        this->used[i] = 0;
+    }
+}
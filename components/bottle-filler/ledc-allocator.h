@@ -0,0 +1,51 @@
+/*
+ * esp-bolle-filler
+ * Copyright (C) Jeroen Dekien 2024 <dekien@gmail.com>
+ *
+ */
+
+#ifndef _LEDC_ALLOCATOR_H_
+#define _LEDC_ALLOCATOR_H_
+
+#include "esp_log.h"
+#include "driver/ledc.h"
+#include "soc/soc_caps.h"
+
+#include <iostream>
+
+using namespace std;
+
+#if SOC_LEDC_SUPPORT_HS_MODE
+#define LEDC_SPEED_MODES 2
+#else
+#define LEDC_SPEED_MODES 1
+#endif
+
+// max fillers, one pwm channel each
+#define MAX_FILLERS (SOC_LEDC_CHANNEL_NUM * LEDC_SPEED_MODES)
+
+struct LedcChannel
+{
+    ledc_mode_t SpeedMode;
+    ledc_channel_t Channel;
+    ledc_timer_t Timer;
+};
+
+// Hands out the pwm channels of the chip, low speed channels first, then the high speed ones where the chip has them (esp32).
+// All pumps run at the same frequency and resolution, so one timer per speed mode serves every channel of that mode.
+class LedcAllocator
+{
+private:
+    uint32_t used[LEDC_SPEED_MODES] = {}; // bit per channel
+    bool configured = false;
+
+    static ledc_mode_t speedMode(uint8_t index);
+
+public:
+    esp_err_t Init(uint32_t frequency, ledc_timer_bit_t resolution);
+    bool Allocate(LedcChannel *channel);
+    void Release(const LedcChannel &channel);
+    void Reset();
+};
+
+#endif // _LEDC_ALLOCATOR_H_
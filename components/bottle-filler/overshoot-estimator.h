@@ -0,0 +1,73 @@
+/*
+ * esp-bolle-filler
+ * Copyright (C) Jeroen Dekien 2024 <dekien@gmail.com>
+ *
+ */
+
+#ifndef _OVERSHOOT_ESTIMATOR_H_
+#define _OVERSHOOT_ESTIMATOR_H_
+
+#include <iostream>
+#include <cstdint>
+
+using namespace std;
+
+// Running estimate of what still ends up in the bottle after the cutoff (or how late the cutoff is in time mode).
+// Exponentially weighted moving average in fixed point, constant memory and no floats so it is cheap after every fill.
+class OvershootEstimator
+{
+public:
+    int32_t Value = 0;    // 4 fractional bits
+    uint16_t Samples = 0; // saturates
+
+    void Update(int32_t measured)
+    {
+        // a negative overshoot is noise (bottle moved, scale drift), never learn from it
+        if (measured < 0)
+        {
+            measured = 0;
+        }
+
+        // a stuck sensor or a very late timer must not overflow the fixed point value
+        if (measured > MaxMeasured)
+        {
+            measured = MaxMeasured;
+        }
+
+        int32_t scaled = measured * (1 << FractionBits);
+
+        // the first sample is taken as is, after that each new one counts for 1/8
+        if (this->Samples == 0)
+        {
+            this->Value = scaled;
+        }
+        else
+        {
+            this->Value += (scaled - this->Value) / Weight;
+        }
+
+        if (this->Samples < UINT16_MAX)
+        {
+            this->Samples++;
+        }
+    };
+
+    int32_t Get() const
+    {
+        return (this->Value + (1 << (FractionBits - 1))) >> FractionBits;
+    };
+
+    void Reset()
+    {
+        this->Value = 0;
+        this->Samples = 0;
+    };
+
+protected:
+private:
+    static const int32_t FractionBits = 4;
+    static const int32_t Weight = 8;
+    static const int32_t MaxMeasured = INT32_MAX >> FractionBits;
+};
+
+#endif // _OVERSHOOT_ESTIMATOR_H_
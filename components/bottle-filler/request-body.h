@@ -0,0 +1,143 @@
+/*
+ * esp-bolle-filler
+ * Copyright (C) Jeroen Dekien 2024 <dekien@gmail.com>
+ *
+ */
+
+#ifndef _REQUEST_BODY_H_
+#define _REQUEST_BODY_H_
+
+#include <esp_http_server.h>
+
+#include <iterator>
+#include <algorithm>
+
+using namespace std;
+
+#define REQUEST_BODY_CHUNK_SIZE 512
+
+// Reads a request body from the socket while the json parser walks it, so the body is never held as a whole.
+// The parser takes Begin/End as an input iterator pair, a new chunk is received when the previous one is used up.
+class RequestBodyReader
+{
+private:
+    httpd_req_t *req;
+    char buf[REQUEST_BODY_CHUNK_SIZE];
+    size_t length = 0;
+    size_t position = 0;
+    size_t remaining = 0;
+    bool failed = false;
+
+    // returns false at the end of the body or when the socket failed
+    bool fill()
+    {
+        if (this->position < this->length)
+        {
+            return true;
+        }
+
+        uint8_t timeouts = 0;
+
+        while (this->remaining > 0 && !this->failed)
+        {
+            int ret = httpd_req_recv(this->req, this->buf, std::min<size_t>(this->remaining, sizeof(this->buf)));
+
+            if (ret == HTTPD_SOCK_ERR_TIMEOUT && ++timeouts < 3)
+            {
+                // slow client, try again
+                continue;
+            }
+
+            if (ret <= 0)
+            {
+                this->failed = true;
+                return false;
+            }
+
+            this->remaining -= ret;
+            this->length = ret;
+            this->position = 0;
+
+            return true;
+        }
+
+        return false;
+    };
+
+public:
+    class Iterator
+    {
+    private:
+        RequestBodyReader *reader;
+
+    public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type = char;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const char *;
+        using reference = const char &;
+
+        Iterator(RequestBodyReader *reader) : reader(reader) {};
+
+        reference operator*() const
+        {
+            return this->reader->buf[this->reader->position];
+        };
+
+        Iterator &operator++()
+        {
+            this->reader->position++;
+            return *this;
+        };
+
+        Iterator operator++(int)
+        {
+            Iterator previous = *this;
+            this->reader->position++;
+            return previous;
+        };
+
+        // the end iterator has no reader, a reader is at the end once nothing more can be received
+        bool operator==(const Iterator &other) const
+        {
+            bool atEnd = this->reader == nullptr || !this->reader->fill();
+            bool otherAtEnd = other.reader == nullptr || !other.reader->fill();
+
+            return atEnd && otherAtEnd;
+        };
+
+        bool operator!=(const Iterator &other) const
+        {
+            return !(*this == other);
+        };
+    };
+
+    RequestBodyReader(httpd_req_t *req) : req(req), remaining(req->content_len) {};
+
+    Iterator Begin()
+    {
+        return Iterator(this);
+    };
+
+    Iterator End()
+    {
+        return Iterator(nullptr);
+    };
+
+    // reads what the parser left, so a response can still be sent on this connection
+    void Drain()
+    {
+        while (!this->failed && this->remaining > 0)
+        {
+            this->position = this->length;
+            this->fill();
+        }
+    };
+
+    bool Failed()
+    {
+        return this->failed;
+    };
+};
+
+#endif // _REQUEST_BODY_H_
@@ -0,0 +1,83 @@
+/*
+ * esp-bolle-filler
+ * Copyright (C) Jeroen Dekien 2024 <dekien@gmail.com>
+ *
+ */
+
+#ifndef _RESPONSE_CACHE_H_
+#define _RESPONSE_CACHE_H_
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <array>
+
+#include "api-request.h"
+
+using namespace std;
+
+enum CachedCommand
+{
+    CachedFillerSettings = 0,
+    CachedSystemSettings,
+    CachedWifiSettings,
+    CachedCommandCount
+};
+
+// Serialized responses of read only commands, kept until the matching save drops them.
+// A version of the source is stored along, so a change that lands later than the save (a config swapped in
+// by the fill scheduler) still makes the entry stale. Only the httpd task uses it, there is no lock.
+class ResponseCache
+{
+public:
+    struct Entry
+    {
+        string Payload;
+        char ETag[11] = {}; // quoted FNV-1a of the payload, the same payload after a reboot gets the same tag
+        uint32_t Version = 0;
+        bool Valid = false;
+    };
+
+private:
+    std::array<Entry, CachedCommandCount> entries;
+
+public:
+    // returns nullptr when the command has to be run again
+    const Entry *Get(CachedCommand command, uint32_t version) const
+    {
+        const Entry &entry = this->entries[command];
+
+        if (!entry.Valid || entry.Version != version)
+        {
+            return nullptr;
+        }
+
+        return &entry;
+    };
+
+    const Entry *Store(CachedCommand command, uint32_t version, string &&payload)
+    {
+        Entry &entry = this->entries[command];
+
+        entry.Payload = std::move(payload);
+        snprintf(entry.ETag, sizeof(entry.ETag), "\"%08" PRIx32 "\"", commandHash(entry.Payload.c_str(), entry.Payload.length()));
+        entry.Version = version;
+        entry.Valid = true;
+
+        return &entry;
+    };
+
+    void Invalidate(CachedCommand command)
+    {
+        this->entries[command].Valid = false;
+    };
+
+    // If-None-Match may hold a list of tags or *
+    static bool Matches(const Entry &entry, const char *ifNoneMatch)
+    {
+        return strcmp(ifNoneMatch, "*") == 0 || strstr(ifNoneMatch, entry.ETag) != nullptr;
+    };
+};
+
+#endif // _RESPONSE_CACHE_H_
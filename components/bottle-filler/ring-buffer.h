@@ -0,0 +1,70 @@
+/*
+ * esp-bolle-filler
+ * Copyright (C) Jeroen Dekien 2024 <dekien@gmail.com>
+ *
+ */
+
+#ifndef _RING_BUFFER_H_
+#define _RING_BUFFER_H_
+
+#include <atomic>
+#include <cstddef>
+
+using namespace std;
+
+// Single producer / single consumer ring buffer, safe to push from an isr without locking.
+// Only atomic loads and stores are used, so it stays lock free on cores without atomic instructions (esp32-c3).
+template <typename T, size_t Capacity>
+class RingBuffer
+{
+    static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of 2");
+
+public:
+    // producer side, returns false when full
+    bool Push(const T &item)
+    {
+        size_t head = this->head.load(std::memory_order_relaxed);
+        size_t tail = this->tail.load(std::memory_order_acquire);
+
+        if (head - tail >= Capacity)
+        {
+            return false;
+        }
+
+        this->items[head & (Capacity - 1)] = item;
+        this->head.store(head + 1, std::memory_order_release);
+
+        return true;
+    }
+
+    // consumer side, returns false when empty
+    bool Pop(T &item)
+    {
+        size_t tail = this->tail.load(std::memory_order_relaxed);
+        size_t head = this->head.load(std::memory_order_acquire);
+
+        if (head == tail)
+        {
+            return false;
+        }
+
+        item = this->items[tail & (Capacity - 1)];
+        this->tail.store(tail + 1, std::memory_order_release);
+
+        return true;
+    }
+
+    // consumer side, drops everything that is queued
+    void Clear()
+    {
+        this->tail.store(this->head.load(std::memory_order_acquire), std::memory_order_release);
+    }
+
+protected:
+private:
+    T items[Capacity];
+    std::atomic<size_t> head{0};
+    std::atomic<size_t> tail{0};
+};
+
+#endif // _RING_BUFFER_H_
@@ -0,0 +1,210 @@
+/*
+ * esp-bolle-filler
+ * Copyright (C) Jeroen Dekien 2024 <dekien@gmail.com>
+ *
+ */
+
+#ifndef _STATUS_SNAPSHOT_H_
+#define _STATUS_SNAPSHOT_H_
+
+#include "freertos/FreeRTOS.h"
+
+#include <array>
+
+#include "filler-config.h"
+#include "fill-command.h"
+
+using namespace std;
+
+// what a client sees of one filler, times are esp_timer times so elapsed and remaining are computed at send time
+struct FillerSnapshot
+{
+    uint8_t Id;
+    FillerStatus Status;
+    int64_t StartedAt; // in us
+    int64_t EndsAt;    // in us, 0 when the end depends on a sensor or a button
+    uint32_t Completed;
+    uint32_t Aborted;
+    uint32_t BatchCount;
+
+    // for the api only, not in the frames, a change here doesn't bump the version
+    uint32_t BatchTarget;
+    uint64_t PumpOnTime; // in ms
+    uint64_t Volume;     // in ml
+    uint32_t FillHandle;
+    uint32_t RefusedHandle;
+    bool LastFillAborted;
+    int32_t OvershootEstimate[3]; // per fill mode
+    uint16_t OvershootSamples[3];
+
+    // what the frames show
+    bool operator!=(const FillerSnapshot &other) const
+    {
+        return this->Id != other.Id || this->Status != other.Status || this->StartedAt != other.StartedAt ||
+               this->EndsAt != other.EndsAt || this->Completed != other.Completed || this->Aborted != other.Aborted ||
+               this->BatchCount != other.BatchCount;
+    };
+
+    bool SameDetails(const FillerSnapshot &other) const
+    {
+        if (this->BatchTarget != other.BatchTarget || this->PumpOnTime != other.PumpOnTime || this->Volume != other.Volume ||
+            this->FillHandle != other.FillHandle || this->RefusedHandle != other.RefusedHandle ||
+            this->LastFillAborted != other.LastFillAborted)
+        {
+            return false;
+        }
+
+        for (uint8_t mode = 0; mode < 3; mode++)
+        {
+            if (this->OvershootEstimate[mode] != other.OvershootEstimate[mode] || this->OvershootSamples[mode] != other.OvershootSamples[mode])
+            {
+                return false;
+            }
+        }
+
+        return true;
+    };
+};
+
+// what GetSchedulerStatus shows, the pending starts are only live ones, oldest first
+struct SchedulerSnapshot
+{
+    std::array<PendingStart, MAX_FILLERS> Pending;
+    uint8_t PendingCount;
+    uint8_t RunningPumps;
+    int64_t LastStartWait; // in us
+    int64_t MaxStartWait;  // in us
+    uint32_t DelayedStarts;
+    uint32_t WatchdogTrips;
+    int64_t LastStartLatency; // in us
+    int64_t MaxStartLatency;  // in us
+
+    bool operator!=(const SchedulerSnapshot &other) const
+    {
+        if (this->PendingCount != other.PendingCount || this->RunningPumps != other.RunningPumps ||
+            this->LastStartWait != other.LastStartWait || this->MaxStartWait != other.MaxStartWait ||
+            this->DelayedStarts != other.DelayedStarts || this->WatchdogTrips != other.WatchdogTrips ||
+            this->LastStartLatency != other.LastStartLatency || this->MaxStartLatency != other.MaxStartLatency)
+        {
+            return true;
+        }
+
+        for (uint8_t i = 0; i < this->PendingCount; i++)
+        {
+            const PendingStart &pending = this->Pending[i];
+            const PendingStart &otherPending = other.Pending[i];
+
+            if (pending.FillerId != otherPending.FillerId || pending.Type != otherPending.Type || pending.QueuedAt != otherPending.QueuedAt)
+            {
+                return true;
+            }
+        }
+
+        return false;
+    };
+};
+
+// Status of all fillers, written by the fill scheduler after every wake and copied out by the status push and the api.
+// The copy is a few hundred bytes, so a spinlock is cheaper than handing out pointers. The scheduler keeps what it
+// wrote last, so the lock is only taken when something changed.
+class StatusSnapshot
+{
+private:
+    std::array<FillerSnapshot, MAX_FILLERS> fillers = {};
+    uint8_t count = 0;
+    std::array<FillerSnapshot, MAX_FILLERS> written = {}; // fill scheduler only
+    uint8_t writtenCount = 0;
+    uint32_t version = 0; // bumped on every change, clients can drop frames they already have
+    portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+
+    // not part of the frames, so it never bumps the version
+    SchedulerSnapshot scheduler = {};
+    SchedulerSnapshot schedulerWritten = {}; // fill scheduler only, the lock is only taken when this changed
+
+public:
+    // returns true when the frames changed
+    bool Publish(const std::array<FillerSnapshot, MAX_FILLERS> &fillers, uint8_t count)
+    {
+        bool changed = count != this->writtenCount;
+        bool detailsChanged = false;
+
+        for (uint8_t i = 0; i < count && !changed; i++)
+        {
+            changed = fillers[i] != this->written[i];
+            detailsChanged = detailsChanged || !fillers[i].SameDetails(this->written[i]);
+        }
+
+        if (!changed && !detailsChanged)
+        {
+            return false;
+        }
+
+        std::copy(fillers.begin(), fillers.begin() + count, this->written.begin());
+        this->writtenCount = count;
+
+        portENTER_CRITICAL(&this->lock);
+        std::copy(fillers.begin(), fillers.begin() + count, this->fillers.begin());
+        this->count = count;
+        if (changed)
+        {
+            this->version++;
+        }
+        portEXIT_CRITICAL(&this->lock);
+
+        return changed;
+    };
+
+    // returns false when there is no filler with that id
+    bool ReadFiller(uint8_t id, FillerSnapshot &filler)
+    {
+        bool found = false;
+
+        portENTER_CRITICAL(&this->lock);
+        for (uint8_t i = 0; i < this->count && !found; i++)
+        {
+            if (this->fillers[i].Id == id)
+            {
+                filler = this->fillers[i];
+                found = true;
+            }
+        }
+        portEXIT_CRITICAL(&this->lock);
+
+        return found;
+    };
+
+    void PublishScheduler(const SchedulerSnapshot &scheduler)
+    {
+        if (!(scheduler != this->schedulerWritten))
+        {
+            return;
+        }
+
+        this->schedulerWritten = scheduler;
+
+        portENTER_CRITICAL(&this->lock);
+        this->scheduler = scheduler;
+        portEXIT_CRITICAL(&this->lock);
+    };
+
+    void ReadScheduler(SchedulerSnapshot &scheduler)
+    {
+        portENTER_CRITICAL(&this->lock);
+        scheduler = this->scheduler;
+        portEXIT_CRITICAL(&this->lock);
+    };
+
+    // returns the number of fillers copied
+    uint8_t Read(std::array<FillerSnapshot, MAX_FILLERS> &fillers, uint32_t &version)
+    {
+        portENTER_CRITICAL(&this->lock);
+        uint8_t count = this->count;
+        std::copy(this->fillers.begin(), this->fillers.begin() + count, fillers.begin());
+        version = this->version;
+        portEXIT_CRITICAL(&this->lock);
+
+        return count;
+    };
+};
+
+#endif // _STATUS_SNAPSHOT_H_
@@ -4,6 +4,9 @@ import { IApiResult } from '@/interfaces/IApiResult';
 export default class WebConn {
   public rootUrl: string | null = null;
 
+  // last body per command sent with an ETag, the device answers 304 while it is unchanged
+  private cachedBodies = new Map<string, { etag: string, body: string }>();
+
   constructor(rootUrl: string) {
     this.rootUrl = rootUrl;
   }
@@ -11,21 +14,41 @@ export default class WebConn {
   doPostRequest(data: any): Promise<IApiResult> {
     return new Promise((resolve, reject) => {
       const url = `${this.rootUrl}api`;
+      const command: string | undefined = data?.command;
+      const cached = command !== undefined ? this.cachedBodies.get(command) : undefined;
+
+      const headers: Record<string, string> = {
+        'Content-Type': 'application/json',
+      };
+
+      if (cached !== undefined) {
+        headers['If-None-Match'] = cached.etag;
+      }
 
       const response = fetch(url, {
         method: 'POST', // *GET, POST, PUT, DELETE, etc.
         mode: 'cors', // no-cors, *cors, same-origin //no-cors doesn't give any data, only gives error about json parse (bug?)
         cache: 'no-cache', // *default, no-cache, reload, force-cache, only-if-cached
         credentials: 'omit', // include, *same-origin, omit
-        headers: {
-          'Content-Type': 'application/json',
-        },
+        headers,
         // redirect: "follow", // manual, *follow, error
         // referrerPolicy: "no-referrer", // no-referrer, *no-referrer-when-downgrade, origin, origin-when-cross-origin, same-origin, strict-origin, strict-origin-when-cross-origin, unsafe-url
         body: JSON.stringify(data), // body data type must match "Content-Type" header
-      }).then((result) => {
-        const apiResult = result.json();
-        resolve(apiResult);
+      }).then(async (result) => {
+        if (result.status === 304 && cached !== undefined) {
+          // parsed again, callers change the data they get
+          resolve(JSON.parse(cached.body));
+          return;
+        }
+
+        const body = await result.text();
+        const etag = result.headers.get('ETag');
+
+        if (command !== undefined && etag !== null) {
+          this.cachedBodies.set(command, { etag, body });
+        }
+
+        resolve(JSON.parse(body));
       }).catch((error) => {
         console.error(error);
         const apiResult: IApiResult = {
@@ -7,4 +7,30 @@ export interface IFillerConfig {
   autoFillSpeed: number;
   manualFillSpeed: number;
   fillTime: number;
+  debounceTime: number;
+  minPressTime: number;
+  longPressTime: number;
+  doublePressTime: number;
+  shortPressAction: number;
+  longPressAction: number;
+  doublePressAction: number;
+  primeTime: number;
+  topUpTime: number;
+  rampUpTime: number;
+  rampDownTime: number;
+  fillMode: number;
+  flowPin: number;
+  pulsesPerLiter: number;
+  targetVolume: number;
+  scaleDataPin: number;
+  scaleClockPin: number;
+  scaleFactor: number;
+  targetWeight: number;
+  inFlightWeight: number;
+  batchTarget: number;
+  bottlePin: number;
+  settleTime: number;
+  maxManualTime: number;
+  noFlowTime: number;
+  stages: Array<[number, number]>; // [amount, speed (%)], amount of this stage in the unit of the fill mode: time (ms), volume (ml) or weight (g)
 }
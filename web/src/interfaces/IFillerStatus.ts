@@ -0,0 +1,9 @@
+export interface IFillerStatus {
+  id: number;
+  status: number; // 0 idle, 1 filling, 2 aborting, 3 manual filling, 4 waiting
+  elapsed: number; // ms
+  remaining: number; // ms, -1 when the end depends on a sensor
+  completed: number;
+  aborted: number;
+  batchCount: number;
+}
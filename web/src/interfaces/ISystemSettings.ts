@@ -1,3 +1,5 @@
 export interface ISystemSettings {
   invertOutputs: boolean;
+  maxConcurrentPumps: number;
+  staggerTime: number;
 }